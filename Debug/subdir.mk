@@ -17,7 +17,7 @@ CPP_DEPS += \
 fp_generate_patterns.o: ../fp_generate_patterns.cpp
 	@echo 'Building file: $<'
 	@echo 'Invoking: Cross G++ Compiler'
-	g++ -O0 -g3 -Wall -c -fmessage-length=0 -std=c++11 -MMD -MP -MF"$(@:%.o=%.d)" -MT"fp_generate_patterns.d" -o "$@" "$<"
+	g++ -O0 -g3 -Wall -c -fmessage-length=0 -std=c++17 -pthread -MMD -MP -MF"$(@:%.o=%.d)" -MT"fp_generate_patterns.d" -o "$@" "$<"
 	@echo 'Finished building: $<'
 	@echo ' '
 
@@ -0,0 +1,69 @@
+//============================================================================
+// Name        : fp_batch.h
+// Description : Batch of parsed samples and their detection results
+//============================================================================
+
+/*
+Parsed samples are collected into a batch of contiguous arrays, evaluated at
+once by AlarmNoiseRejectDetector::process() and then formatted. Timestamp
+texts (printed as they were read) are copied into one reusable buffer, so the
+batch does not depend on the input buffers.
+ */
+
+#ifndef FP_BATCH_H_
+#define FP_BATCH_H_
+
+#include <string>
+#include <string_view>
+#include <cstdint>
+
+#include "fp_detector.h"
+
+// Number of samples in one batch
+#define SAMPLE_BATCH_SIZE 1024
+
+struct SampleBatch {
+	size_t n = 0;
+	long long first_lineid = 0;   // lineid of the first sample, following samples are consecutive
+	bool input_block_end = false; // input reader waits for more data after this batch
+	int64_t read_ns = 0;          // when the first sample was read, with latency tracking (see fp_histogram.h)
+
+	int64_t t[SAMPLE_BATCH_SIZE];
+	float v[SAMPLE_BATCH_SIZE];
+	AlarmNoiseRejectResult r[SAMPLE_BATCH_SIZE];
+
+	// timestamp texts, text of sample i ends at ts_end[i]
+	std::string ts_text;
+	uint32_t ts_end[SAMPLE_BATCH_SIZE];
+
+	bool full() const { return n == SAMPLE_BATCH_SIZE; }
+
+	void clear() {
+		n = 0;
+		input_block_end = false;
+		ts_text.clear();   // keeps capacity
+	}
+
+	void add(long long lineid, std::string_view timestamp, int64_t t_usec, float value) {
+		if (n == 0)
+			first_lineid = lineid;
+		t[n] = t_usec;
+		v[n] = value;
+		ts_text.append(timestamp.data(), timestamp.size());
+		ts_end[n] = ts_text.size();
+		n++;
+	}
+
+	std::string_view timestamp(size_t i) const {
+		size_t start = i ? ts_end[i - 1] : 0;
+		return std::string_view(ts_text.data() + start, ts_end[i] - start);
+	}
+
+	// evaluates all samples of the batch
+	template <class Detector>
+	void detect(Detector& detector) {
+		detector.process(t, v, n, r);
+	}
+};
+
+#endif /* FP_BATCH_H_ */
@@ -0,0 +1,353 @@
+//============================================================================
+// Name        : fp_bench.cpp
+// Description : Stage-level microbenchmarks of fp_generate_patterns
+//============================================================================
+
+/*
+Measures the processing stages separately, each in the original variant
+(as in the first version of fp_generate_patterns) and the current one:
+
+split      splitting of the line to timestamp and value, trim()
+timestamp  timestamp text to time (sscanf + mktime, TimestampDecoder)
+value      value text to number (std::stod, std::from_chars)
+detect     alarm_noisereject state machine (push, process, specialized detector,
+           float and fixed-point)
+output     formatting of output rows (std::ostream, OutputWriter), to /dev/null
+
+to be run from Debug/ using e.g.:
+./fp_bench testdata.csv
+
+options:
+--synthetic N    number of synthetic samples (see fp_synth.h), default 1000000, 0 for none
+--min-time SEC   minimum measured time of each variant, default 0.3
+
+Results are printed as lines of
+dataset;stage;variant;samples;ns_per_sample;samples_per_sec
+ */
+
+#include <iostream>
+#include <fstream>
+#include <sstream>
+#include <string>
+#include <string_view>
+#include <vector>
+#include <chrono>
+#include <charconv>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <ctime>
+#include <fcntl.h>
+#include <unistd.h>
+
+#include "fp_detector.h"
+#include "fp_reader.h"
+#include "fp_synth.h"
+#include "fp_timestamp.h"
+#include "fp_writer.h"
+
+// keeps results of measured code alive
+static volatile uint64_t sink;
+
+// input lines and the data of all stages, each stage is measured on its own input
+struct Dataset {
+	std::string name;
+	std::string text;
+	std::vector<std::string_view> lines;
+
+	std::vector<std::string_view> timestamps;
+	std::vector<std::string_view> valuetexts;
+	std::vector<int64_t> t;
+	std::vector<float> v;
+	std::vector<AlarmNoiseRejectResult> r;
+};
+
+// splits text to lines and prepares input of all stages
+static void prepare(Dataset& data) {
+	std::string_view text(data.text);
+	while (!text.empty()) {
+		size_t eol = text.find('\n');
+		std::string_view line = text.substr(0, eol);
+		if (!line.empty() && line.back() == '\r')
+			line.remove_suffix(1);
+		text.remove_prefix(eol == std::string_view::npos ? text.size() : eol + 1);
+
+		std::string_view ts, value;
+		split_fields(line, ts, value);
+		double parsed;
+		if (std::from_chars(value.data(), value.data() + value.size(), parsed).ec != std::errc())
+			continue;
+		data.lines.push_back(line);
+		data.timestamps.push_back(ts);
+		data.valuetexts.push_back(value);
+		data.v.push_back(parsed);
+	}
+
+	TimestampDecoder decoder;
+	data.t.resize(data.lines.size());
+	for (size_t i = 0; i < data.lines.size(); i++)
+		decoder.decode(data.timestamps[i], data.t[i]);
+
+	AlarmNoiseRejectDetector detector;
+	data.r.resize(data.lines.size());
+	detector.process(data.t.data(), data.v.data(), data.v.size(), data.r.data());
+}
+
+static double min_time = 0.3;
+
+// runs f (processing n samples) until min_time elapses, prints result
+template <class F>
+static void bench(const Dataset& data, const char* stage, const char* variant, F f) {
+	size_t n = data.lines.size();
+	if (!n)
+		return;
+	f(); // warm up
+
+	long long runs = 0;
+	auto start = std::chrono::steady_clock::now();
+	double elapsed;
+	do {
+		f();
+		runs++;
+		elapsed = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+	} while (elapsed < min_time);
+
+	double ns = elapsed * 1e9 / (runs * n);
+	std::cout << data.name << ';' << stage << ';' << variant << ';' << n << ';'
+		<< ns << ';' << static_cast<long long>(1e9 / ns) << std::endl;
+}
+
+
+// original trim() of std::string
+static std::string trim_string(const std::string& str) {
+	size_t first = str.find_first_not_of(' ');
+	if (std::string::npos == first)
+		return str;
+	size_t last = str.find_last_not_of(' ');
+	return str.substr(first, (last - first + 1));
+}
+
+static void bench_split(const Dataset& data) {
+	bench(data, "split", "std::string trim", [&] {
+		std::string lineread, p1, p2;
+		uint64_t sum = 0;
+		for (std::string_view line : data.lines) {
+			lineread.assign(line.data(), line.size());
+			size_t pos = lineread.find(';');
+			p1 = trim_string(lineread.substr(0, pos));
+			p2 = trim_string(lineread.erase(0, pos + 1));
+			sum += p1.size() + p2.size();
+		}
+		sink = sum;
+	});
+
+	bench(data, "split", "split_fields", [&] {
+		uint64_t sum = 0;
+		for (std::string_view line : data.lines) {
+			std::string_view ts, value;
+			split_fields(line, ts, value);
+			sum += ts.size() + value.size();
+		}
+		sink = sum;
+	});
+}
+
+static void bench_timestamp(const Dataset& data) {
+	bench(data, "timestamp", "sscanf+mktime", [&] {
+		char c[100];
+		struct tm t = {0};
+		int d, m, y, h, mi, s, ms;
+		uint64_t sum = 0;
+		for (std::string_view ts : data.timestamps) {
+			size_t len = ts.size() < sizeof(c) - 1 ? ts.size() : sizeof(c) - 1;
+			memcpy(c, ts.data(), len);
+			c[len] = '\0';
+			sscanf(c, "%d-%d-%d %d:%d:%d.%d", &d, &m, &y, &h, &mi, &s, &ms);
+			t.tm_year = y - 1900; t.tm_mon = m; t.tm_mday = d; t.tm_hour = h; t.tm_min = mi; t.tm_sec = s;
+			sum += mktime(&t) + ms;
+		}
+		sink = sum;
+	});
+
+	bench(data, "timestamp", "TimestampDecoder", [&] {
+		TimestampDecoder decoder;
+		int64_t usec;
+		uint64_t sum = 0;
+		for (std::string_view ts : data.timestamps) {
+			decoder.decode(ts, usec);
+			sum += usec;
+		}
+		sink = sum;
+	});
+
+	bench(data, "timestamp", "format_timestamp", [&] {
+		char buf[TIMESTAMP_TEXT_LEN];
+		uint64_t sum = 0;
+		for (int64_t t : data.t) {
+			format_timestamp(t, 0, buf);
+			sum += buf[25];
+		}
+		sink = sum;
+	});
+}
+
+static void bench_value(const Dataset& data) {
+	bench(data, "value", "std::stod", [&] {
+		std::string p2;
+		double sum = 0;
+		for (std::string_view value : data.valuetexts) {
+			p2.assign(value.data(), value.size());
+			sum += std::stod(p2);
+		}
+		sink = sum;
+	});
+
+	bench(data, "value", "from_chars", [&] {
+		double sum = 0;
+		for (std::string_view value : data.valuetexts) {
+			double parsed;
+			std::from_chars(value.data(), value.data() + value.size(), parsed);
+			sum += parsed;
+		}
+		sink = sum;
+	});
+}
+
+static void bench_detect(const Dataset& data) {
+	std::vector<AlarmNoiseRejectResult> r(data.v.size());
+	size_t n = data.v.size();
+
+	bench(data, "detect", "push", [&] {
+		AlarmNoiseRejectDetector detector;
+		for (size_t i = 0; i < n; i++)
+			r[i] = detector.push(data.t[i], data.v[i]);
+		sink = r[n - 1].patternid;
+	});
+
+	bench(data, "detect", "process", [&] {
+		AlarmNoiseRejectDetector detector;
+		detector.process(data.t.data(), data.v.data(), n, r.data());
+		sink = r[n - 1].patternid;
+	});
+
+	bench(data, "detect", "process specialized", [&] {
+		dispatch_detector(AlarmNoiseRejectParams(), [&](auto detector) {
+			detector.process(data.t.data(), data.v.data(), n, r.data());
+		});
+		sink = r[n - 1].patternid;
+	});
+
+	bench(data, "detect", "process fixed", [&] {
+		FixedAlarmNoiseRejectDetector detector;
+		detector.process(data.t.data(), data.v.data(), n, r.data());
+		sink = r[n - 1].patternid;
+	});
+
+	bench(data, "detect", "process fixed specialized", [&] {
+		AlarmNoiseRejectParams params;
+		params.fixed_point = true;
+		dispatch_detector(params, [&](auto detector) {
+			detector.process(data.t.data(), data.v.data(), n, r.data());
+		});
+		sink = r[n - 1].patternid;
+	});
+}
+
+static void bench_output(const Dataset& data) {
+	size_t n = data.v.size();
+
+	// rows as written by the original loop, to stream s
+	auto write_ostream = [&](std::ostream& s, bool endl) {
+		for (size_t i = 0; i < n; i++) {
+			const AlarmNoiseRejectResult& r = data.r[i];
+			s << i + 1 << ';' << data.timestamps[i] << ";";
+			s << data.v[i] << ";" << r.diff << ";" << r.diffavg << ";";
+			s << static_cast<int>(r.isdetect) << ";";
+			s << static_cast<int>(r.isalarm) << ";";
+			s << static_cast<int>(r.iswait) << ";" << r.patternid;
+			if (endl)
+				s << std::endl;
+			else
+				s << '\n';
+		}
+	};
+
+	std::ofstream devnull("/dev/null");
+	bench(data, "output", "ostream endl", [&] { write_ostream(devnull, true); });
+	bench(data, "output", "ostream", [&] { write_ostream(devnull, false); devnull.flush(); });
+
+	int fd = open("/dev/null", O_WRONLY);
+	bench(data, "output", "OutputWriter", [&] {
+		OutputWriter out(fd);
+		for (size_t i = 0; i < n; i++) {
+			const AlarmNoiseRejectResult& r = data.r[i];
+			out.put_int(i + 1); out.put(';'); out.put(data.timestamps[i]); out.put(';');
+			out.put_float(data.v[i]); out.put(';'); out.put_float(r.diff); out.put(';'); out.put_float(r.diffavg); out.put(';');
+			out.put_int(r.isdetect); out.put(';');
+			out.put_int(r.isalarm); out.put(';');
+			out.put_int(r.iswait); out.put(';'); out.put_int(r.patternid);
+			out.end_row(r.isalarm);
+		}
+	});
+	close(fd);
+}
+
+static void bench_all(const Dataset& data) {
+	bench_split(data);
+	bench_timestamp(data);
+	bench_value(data);
+	bench_detect(data);
+	bench_output(data);
+}
+
+
+int main(int argc, char* argv[]) {
+	const char* testdata = nullptr;
+	long synthetic = 1000000;
+
+	for (int i = 1; i < argc; i++) {
+		if (!strcmp(argv[i], "--synthetic") && i + 1 < argc)
+			synthetic = atol(argv[++i]);
+		else if (!strcmp(argv[i], "--min-time") && i + 1 < argc)
+			min_time = atof(argv[++i]);
+		else if (strncmp(argv[i], "--", 2) != 0)
+			testdata = argv[i];
+		else {
+			std::cerr << "Usage: fp_bench [testdata.csv] [--synthetic N] [--min-time SEC]" << std::endl;
+			return 1;
+		}
+	}
+
+	std::cout << "dataset;stage;variant;samples;ns_per_sample;samples_per_sec" << std::endl;
+
+	if (testdata) {
+		Dataset data;
+		data.name = testdata;
+		std::ifstream in(testdata, std::ios::binary);
+		if (!in) {
+			std::cerr << "Cannot open " << testdata << std::endl;
+			return 1;
+		}
+		std::ostringstream text;
+		text << in.rdbuf();
+		data.text = text.str();
+		prepare(data);
+		bench_all(data);
+	}
+
+	if (synthetic > 0) {
+		Dataset data;
+		data.name = "synthetic";
+		SynthSource source;
+		int64_t t;
+		float v;
+		for (long i = 0; i < synthetic; i++) {
+			source.next(t, v);
+			synth_line(t, v, 0, data.text);
+		}
+		prepare(data);
+		bench_all(data);
+	}
+
+	return 0;
+}
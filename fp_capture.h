@@ -0,0 +1,381 @@
+//============================================================================
+// Name        : fp_capture.h
+// Description : Binary columnar capture files
+//============================================================================
+
+/*
+Captures that are analyzed repeatedly are stored in a binary columnar file,
+so that they are not parsed again on every run:
+
+CaptureHeader           fixed size, see below
+CaptureChannel[N]       channel metadata
+(padding to 64 bytes)
+int64 timestamps[n]     microseconds since epoch (UTC)
+(padding to 64 bytes)
+values of channel 0     n x int32 or n x float32
+(padding to 64 bytes)
+values of channel 1
+...
+(padding to 64 bytes)
+embedded data           optional, detector checkpoints (see fp_checkpoint.h)
+
+All numbers are little-endian. The file is written by CaptureWriter (e.g.
+converted from CSV input, see --convert-to) and read by CaptureFile, which
+memory maps it; the columns are then used by the detector directly.
+CaptureWriter::embed() adds (or replaces) embedded data of a finished file.
+ */
+
+#ifndef FP_CAPTURE_H_
+#define FP_CAPTURE_H_
+
+#include <string>
+#include <string_view>
+#include <vector>
+#include <memory>
+#include <cstdint>
+#include <cmath>
+#include <cstring>
+#include <cstdio>
+#include <cerrno>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "fp_writer.h"
+
+#define CAPTURE_MAGIC "FPCAPT\r\n"
+#define CAPTURE_VERSION 1
+
+// value types of channel columns
+#define CAPTURE_INT32 1
+#define CAPTURE_FLOAT32 2
+
+// columns are aligned to this
+#define CAPTURE_ALIGN 64
+
+struct CaptureHeader {
+	char magic[8];                // CAPTURE_MAGIC
+	uint32_t version;             // CAPTURE_VERSION
+	uint32_t header_size;         // sizeof(CaptureHeader)
+	uint32_t channels;            // number of value columns
+	uint32_t value_type;          // CAPTURE_INT32 or CAPTURE_FLOAT32
+	uint64_t sample_count;        // number of rows
+	int64_t utc_offset_sec;       // local time offset of the source timestamps
+	uint64_t checkpoints_offset;  // embedded data (checkpoints), 0 if none
+	uint64_t checkpoints_size;
+	uint8_t reserved[64];
+};
+
+struct CaptureChannel {
+	char name[48];                // zero terminated
+	uint8_t reserved[16];
+};
+
+// true if the value can be stored in an int32 column as it is (whole number in range)
+inline bool capture_int32_value(double v) {
+	return v >= INT32_MIN && v <= INT32_MAX && v == std::trunc(v);
+}
+
+// rounds up to CAPTURE_ALIGN
+inline uint64_t capture_align(uint64_t x) {
+	return (x + CAPTURE_ALIGN - 1) / CAPTURE_ALIGN * CAPTURE_ALIGN;
+}
+
+// offset of the timestamp column
+inline uint64_t capture_timestamps_offset(uint32_t channels) {
+	return capture_align(sizeof(CaptureHeader) + channels * sizeof(CaptureChannel));
+}
+
+// offset of values of channel ch
+inline uint64_t capture_column_offset(uint32_t channels, uint64_t count, uint32_t ch) {
+	return capture_align(capture_timestamps_offset(channels) + count * sizeof(int64_t)) +
+		ch * capture_align(count * 4);
+}
+
+// end of the last column
+inline uint64_t capture_columns_end(uint32_t channels, uint64_t count) {
+	return capture_column_offset(channels, count, channels - 1) + count * 4;
+}
+
+
+// memory mapped capture file
+class CaptureFile {
+public:
+	CaptureFile() {}
+	~CaptureFile() { close(); }
+
+	CaptureFile(const CaptureFile&) = delete;
+	CaptureFile& operator=(const CaptureFile&) = delete;
+
+	// maps and verifies the file, false with error message in error()
+	bool open(const char* filename) {
+		close();
+		int fd = ::open(filename, O_RDONLY);
+		if (fd < 0)
+			return fail(std::string("cannot open ") + filename + ": " + strerror(errno));
+		struct stat st;
+		if (fstat(fd, &st) != 0 || static_cast<size_t>(st.st_size) < sizeof(CaptureHeader)) {
+			::close(fd);
+			return fail(std::string(filename) + " is not a capture file");
+		}
+		void* p = mmap(nullptr, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+		::close(fd);
+		if (p == MAP_FAILED)
+			return fail(std::string("cannot map ") + filename + ": " + strerror(errno));
+		madvise(p, st.st_size, MADV_SEQUENTIAL);
+		map = static_cast<const char*>(p);
+		map_size = st.st_size;
+
+		const CaptureHeader& h = header();
+		if (memcmp(h.magic, CAPTURE_MAGIC, 8) != 0 || h.version != CAPTURE_VERSION ||
+			h.header_size != sizeof(CaptureHeader))
+			return fail(std::string(filename) + " is not a capture file (or unsupported version)");
+		if (h.channels == 0 || (h.value_type != CAPTURE_INT32 && h.value_type != CAPTURE_FLOAT32))
+			return fail(std::string(filename) + ": invalid capture header");
+		if (h.sample_count && capture_columns_end(h.channels, h.sample_count) > map_size)
+			return fail(std::string(filename) + ": capture file is truncated");
+		if (h.checkpoints_offset + h.checkpoints_size > map_size)
+			return fail(std::string(filename) + ": capture file is truncated");
+		return true;
+	}
+
+	void close() {
+		if (map)
+			munmap(const_cast<char*>(map), map_size);
+		map = nullptr;
+		map_size = 0;
+	}
+
+	const CaptureHeader& header() const { return *reinterpret_cast<const CaptureHeader*>(map); }
+	const CaptureChannel& channel(uint32_t ch) const {
+		return reinterpret_cast<const CaptureChannel*>(map + sizeof(CaptureHeader))[ch];
+	}
+
+	uint32_t channels() const { return header().channels; }
+	uint64_t size() const { return header().sample_count; }
+	bool is_float() const { return header().value_type == CAPTURE_FLOAT32; }
+
+	const int64_t* timestamps() const {
+		return reinterpret_cast<const int64_t*>(map + capture_timestamps_offset(channels()));
+	}
+	const float* float_column(uint32_t ch) const {
+		return reinterpret_cast<const float*>(map + capture_column_offset(channels(), size(), ch));
+	}
+	const int32_t* int_column(uint32_t ch) const {
+		return reinterpret_cast<const int32_t*>(map + capture_column_offset(channels(), size(), ch));
+	}
+
+	// value of channel ch in row i as float (as the detector uses it)
+	float value(uint32_t ch, uint64_t i) const {
+		return is_float() ? float_column(ch)[i] : static_cast<float>(int_column(ch)[i]);
+	}
+
+	// converts values of channel ch in rows [first, first+n) to float
+	void values(uint32_t ch, uint64_t first, size_t n, float* out) const {
+		if (is_float())
+			memcpy(out, float_column(ch) + first, n * sizeof(float));
+		else {
+			const int32_t* col = int_column(ch) + first;
+			for (size_t i = 0; i < n; i++)
+				out[i] = col[i];
+		}
+	}
+
+	// raw mapped bytes
+	const char* data() const { return map; }
+
+	// embedded data, empty if none
+	std::string_view embedded() const {
+		return std::string_view(map + header().checkpoints_offset, header().checkpoints_size);
+	}
+
+	const std::string& error() const { return err; }
+
+private:
+	bool fail(const std::string& message) {
+		err = message;
+		close();
+		return false;
+	}
+
+	const char* map = nullptr;
+	size_t map_size = 0;
+	std::string err;
+};
+
+
+// writes capture file row by row
+// timestamps go directly to the file, value columns to temporary files
+// which are appended by finish() when the number of rows is known
+class CaptureWriter {
+public:
+	CaptureWriter() {}
+	~CaptureWriter() { cleanup(); }
+
+	CaptureWriter(const CaptureWriter&) = delete;
+	CaptureWriter& operator=(const CaptureWriter&) = delete;
+
+	// creates file, false with error message in error()
+	bool create(const char* filename, uint32_t channels, uint32_t value_type, int64_t utc_offset_sec) {
+		fd = ::open(filename, O_RDWR | O_CREAT | O_TRUNC, 0644);
+		if (fd < 0)
+			return fail(std::string("cannot create ") + filename + ": " + strerror(errno));
+
+		memset(&h, 0, sizeof(h));
+		memcpy(h.magic, CAPTURE_MAGIC, 8);
+		h.version = CAPTURE_VERSION;
+		h.header_size = sizeof(CaptureHeader);
+		h.channels = channels;
+		h.value_type = value_type;
+		h.utc_offset_sec = utc_offset_sec;
+
+		// header (completed by finish()) and channel table
+		std::vector<char> head(capture_timestamps_offset(channels), 0);
+		for (uint32_t ch = 0; ch < channels; ch++) {
+			CaptureChannel c;
+			memset(&c, 0, sizeof(c));
+			snprintf(c.name, sizeof(c.name), "ch%u", ch);
+			memcpy(&head[sizeof(CaptureHeader) + ch * sizeof(CaptureChannel)], &c, sizeof(c));
+		}
+		if (pwrite(fd, head.data(), head.size(), 0) != static_cast<ssize_t>(head.size()))
+			return fail(std::string("cannot write ") + filename + ": " + strerror(errno));
+		if (lseek(fd, head.size(), SEEK_SET) < 0)
+			return fail(std::string("cannot seek ") + filename + ": " + strerror(errno));
+
+		ts_out.reset(new OutputWriter(fd, FLUSH_EXIT));
+		for (uint32_t ch = 0; ch < channels; ch++) {
+			FILE* tmp = tmpfile();
+			if (!tmp)
+				return fail(std::string("cannot create temporary file: ") + strerror(errno));
+			tmp_files.push_back(tmp);
+			column_out.emplace_back(new OutputWriter(fileno(tmp), FLUSH_EXIT));
+		}
+		return true;
+	}
+
+	// adds row, values[0..channels-1], false with error message in error() (and the
+	// writer closed) if a value does not fit an int32 column (see capture_int32_value())
+	bool add(int64_t t_usec, const double* values) {
+		if (h.value_type == CAPTURE_INT32) {
+			for (uint32_t ch = 0; ch < h.channels; ch++) {
+				if (!capture_int32_value(values[ch])) {
+					char text[32];
+					snprintf(text, sizeof(text), "%.17g", values[ch]);
+					return fail(std::string("value ") + text + " of row " + std::to_string(h.sample_count + 1) +
+						" is not a 32-bit integer");
+				}
+			}
+		}
+
+		ts_out->put(std::string_view(reinterpret_cast<const char*>(&t_usec), sizeof(t_usec)));
+		for (uint32_t ch = 0; ch < h.channels; ch++) {
+			if (h.value_type == CAPTURE_INT32) {
+				int32_t v = static_cast<int32_t>(values[ch]);
+				column_out[ch]->put(std::string_view(reinterpret_cast<const char*>(&v), sizeof(v)));
+			} else {
+				float v = static_cast<float>(values[ch]);
+				column_out[ch]->put(std::string_view(reinterpret_cast<const char*>(&v), sizeof(v)));
+			}
+		}
+		h.sample_count++;
+		return true;
+	}
+
+	// appends value columns and completes header, false on error
+	bool finish() {
+		ts_out->flush();
+		if (ts_out->failed())
+			return fail(std::string("write error: ") + strerror(ts_out->error()));
+
+		for (uint32_t ch = 0; ch < h.channels; ch++) {
+			column_out[ch]->flush();
+			if (column_out[ch]->failed())
+				return fail(std::string("temporary file write error: ") + strerror(column_out[ch]->error()));
+
+			// copy column to its position
+			int tmpfd = fileno(tmp_files[ch]);
+			off_t dst = capture_column_offset(h.channels, h.sample_count, ch);
+			off_t src = 0;
+			uint64_t left = h.sample_count * 4;
+			std::vector<char> buf(1 << 20);
+			while (left) {
+				ssize_t n = pread(tmpfd, buf.data(), left < buf.size() ? left : buf.size(), src);
+				if (n <= 0)
+					return fail(std::string("temporary file read error: ") + strerror(errno));
+				if (pwrite(fd, buf.data(), n, dst) != n)
+					return fail(std::string("write error: ") + strerror(errno));
+				src += n;
+				dst += n;
+				left -= n;
+			}
+		}
+
+		// padding of the last column
+		off_t end = capture_columns_end(h.channels, h.sample_count);
+		if (ftruncate(fd, end) != 0)
+			return fail(std::string("write error: ") + strerror(errno));
+
+		if (pwrite(fd, &h, sizeof(h), 0) != sizeof(h))
+			return fail(std::string("write error: ") + strerror(errno));
+		cleanup();
+		return true;
+	}
+
+	// writes data behind the columns of the finished capture file, replaces previous
+	// embedded data, false with error message in error()
+	bool embed(const char* filename, std::string_view data) {
+		fd = ::open(filename, O_RDWR);
+		if (fd < 0)
+			return fail(std::string("cannot open ") + filename + ": " + strerror(errno));
+		if (pread(fd, &h, sizeof(h), 0) != sizeof(h) || memcmp(h.magic, CAPTURE_MAGIC, 8) != 0 ||
+				h.version != CAPTURE_VERSION || h.header_size != sizeof(CaptureHeader) || h.channels == 0)
+			return fail(std::string(filename) + " is not a capture file (or unsupported version)");
+
+		uint64_t end = capture_columns_end(h.channels, h.sample_count);
+		h.checkpoints_offset = data.empty() ? 0 : capture_align(end);
+		h.checkpoints_size = data.size();
+		if (ftruncate(fd, end) != 0)
+			return fail(std::string("write error: ") + strerror(errno));
+		if (!data.empty() && (ftruncate(fd, h.checkpoints_offset) != 0 ||
+				pwrite(fd, data.data(), data.size(), h.checkpoints_offset) != static_cast<ssize_t>(data.size())))
+			return fail(std::string("write error: ") + strerror(errno));
+		if (pwrite(fd, &h, sizeof(h), 0) != sizeof(h))
+			return fail(std::string("write error: ") + strerror(errno));
+		cleanup();
+		return true;
+	}
+
+	// number of rows added so far
+	uint64_t size() const { return h.sample_count; }
+
+	const std::string& error() const { return err; }
+
+private:
+	bool fail(const std::string& message) {
+		err = message;
+		cleanup();
+		return false;
+	}
+
+	void cleanup() {
+		// writers flush to their files on destruction, before the files are closed
+		ts_out.reset();
+		column_out.clear();
+		for (FILE* f : tmp_files)
+			fclose(f);
+		tmp_files.clear();
+		if (fd >= 0)
+			::close(fd);
+		fd = -1;
+	}
+
+	int fd = -1;
+	CaptureHeader h;
+	std::unique_ptr<OutputWriter> ts_out;
+	std::vector<FILE*> tmp_files;
+	std::vector<std::unique_ptr<OutputWriter>> column_out;
+	std::string err;
+};
+
+#endif /* FP_CAPTURE_H_ */
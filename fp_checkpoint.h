@@ -0,0 +1,277 @@
+//============================================================================
+// Name        : fp_checkpoint.h
+// Description : Checkpoint file of detector state and stream positions
+//============================================================================
+
+/*
+A checkpoint holds everything needed to continue processing exactly where it
+was taken: detector parameters (resume is refused with other ones), complete
+detector state (diffavg, thresholding count, last value, wait and pattern
+timers, patternid, sampling counter), lineid of the last output sample, and
+byte offsets of the input consumed so far and of the output written so far.
+
+Checkpoint checkpoint;
+checkpoint.data = ...;
+if (!checkpoint.save(filename))      // atomic: written to filename.tmp, synced and renamed
+	... checkpoint.error()
+...
+if (!checkpoint.load(filename))      // checks magic, version, size and checksum
+	... checkpoint.missing() or checkpoint.error()
+
+The file is a single fixed-size record in native byte order, followed by its
+FNV-1a checksum; it is meant for restarts on the same machine.
+
+CaptureCheckpoints are states of the detector before given rows of a capture,
+embedded in the capture file (see fp_capture.h) to evaluate its segments in
+parallel (see fp_parallel.h):
+
+CaptureCheckpoints checkpoints;
+checkpoints.params = params;
+checkpoints.list.push_back(...);          // ascending rows
+writer.embed(filename, checkpoints.serialize());
+...
+if (!checkpoints.parse(capture.embedded()))
+	... checkpoints.error()
+
+The embedded block is a CaptureCheckpointsHeader, CaptureCheckpoint records
+and FNV-1a checksum of both.
+ */
+
+#ifndef FP_CHECKPOINT_H_
+#define FP_CHECKPOINT_H_
+
+#include <string>
+#include <string_view>
+#include <vector>
+#include <cstdint>
+#include <cstddef>
+#include <cstring>
+#include <cerrno>
+#include <cstdio>
+#include <unistd.h>
+#include <fcntl.h>
+
+#include "fp_detector.h"
+
+#define CHECKPOINT_MAGIC "FPCHKPT\n"
+#define CHECKPOINT_VERSION 2
+
+#define CAPTURE_CHECKPOINTS_MAGIC "FPCPTS\r\n"
+#define CAPTURE_CHECKPOINTS_VERSION 1
+
+struct CheckpointData {
+	AlarmNoiseRejectParams params;
+	AlarmNoiseRejectState state;
+	int64_t lineid;          // lineid of the last output sample
+	uint64_t input_offset;   // input bytes consumed (up to the end of the last line taken)
+	uint64_t output_offset;  // output bytes written (file offset if output is a file, else 0)
+};
+
+struct CheckpointRecord {
+	char magic[8];
+	uint32_t version;
+	uint32_t size;           // sizeof(CheckpointRecord)
+	CheckpointData data;
+	uint64_t checksum;       // FNV-1a of all preceding bytes
+};
+
+// detector state before a row of a capture
+struct CaptureCheckpoint {
+	uint64_t row;            // first row evaluated from the state
+	int64_t lineid;          // lineid of the last output sample before the row
+	AlarmNoiseRejectState state;
+};
+
+struct CaptureCheckpointsHeader {
+	char magic[8];
+	uint32_t version;
+	uint32_t record_size;    // sizeof(CaptureCheckpoint)
+	uint64_t count;          // number of records following the header
+	AlarmNoiseRejectParams params;   // the states are valid for these only
+};
+
+// FNV-1a hash of len bytes
+inline uint64_t checkpoint_checksum(const void* data, size_t len) {
+	const unsigned char* p = static_cast<const unsigned char*>(data);
+	uint64_t h = 0xcbf29ce484222325ULL;
+	for (size_t i = 0; i < len; i++) {
+		h ^= p[i];
+		h *= 0x100000001b3ULL;
+	}
+	return h;
+}
+
+// member-wise copies, keep zeroed padding of dst (checksums depend on the values only)
+inline void copy_checkpoint_params(AlarmNoiseRejectParams& dst, const AlarmNoiseRejectParams& src) {
+	dst.sample_each = src.sample_each;
+	dst.initial_avg_diff = src.initial_avg_diff;
+	dst.number_of_points_to_alarm = src.number_of_points_to_alarm;
+	dst.wait_state_usec = src.wait_state_usec;
+	dst.multiplicator_to_detect = src.multiplicator_to_detect;
+	dst.n_amend_avgdiff = src.n_amend_avgdiff;
+	dst.pattern_state_usec = src.pattern_state_usec;
+	dst.fixed_point = src.fixed_point;
+}
+
+inline void copy_checkpoint_state(AlarmNoiseRejectState& dst, const AlarmNoiseRejectState& src) {
+	dst.diffavg = src.diffavg;
+	dst.lastval = src.lastval;
+	dst.numthresholded = src.numthresholded;
+	dst.patternid = src.patternid;
+	dst.alarmraisetime = src.alarmraisetime;
+	dst.patternraisetime = src.patternraisetime;
+	dst.cursample = src.cursample;
+	dst.isalarm = src.isalarm;
+	dst.iswait = src.iswait;
+	dst.ispattern = src.ispattern;
+	dst.started = src.started;
+	dst.diffavg_q = src.diffavg_q;
+	dst.lastval_i = src.lastval_i;
+}
+
+
+class Checkpoint {
+public:
+	CheckpointData data;
+
+	Checkpoint() { memset(static_cast<void*>(&data), 0, sizeof(data)); }
+
+	// writes the checkpoint atomically, false with error message in error()
+	bool save(const char* filename) {
+		// padding bytes are zero, so the checksum depends on the values only
+		CheckpointRecord rec;
+		memset(static_cast<void*>(&rec), 0, sizeof(rec));
+		memcpy(rec.magic, CHECKPOINT_MAGIC, sizeof(rec.magic));
+		rec.version = CHECKPOINT_VERSION;
+		rec.size = sizeof(rec);
+		copy_data(rec.data, data);
+		rec.checksum = checkpoint_checksum(&rec, offsetof(CheckpointRecord, checksum));
+
+		std::string tmp = std::string(filename) + ".tmp";
+		int fd = open(tmp.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+		if (fd < 0)
+			return fail("cannot create " + tmp + ": " + strerror(errno));
+		bool ok = write(fd, &rec, sizeof(rec)) == static_cast<ssize_t>(sizeof(rec)) && fdatasync(fd) == 0;
+		int err = errno;
+		close(fd);
+		if (!ok)
+			return fail("cannot write " + tmp + ": " + strerror(err));
+		if (rename(tmp.c_str(), filename) < 0)
+			return fail("cannot rename " + tmp + " to " + filename + ": " + strerror(errno));
+		return true;
+	}
+
+	// reads and verifies the checkpoint, false with error message in error()
+	// (missing() is true if the file does not exist)
+	bool load(const char* filename) {
+		not_found = false;
+		int fd = open(filename, O_RDONLY | O_CLOEXEC);
+		if (fd < 0) {
+			not_found = errno == ENOENT;
+			return fail(std::string("cannot open ") + filename + ": " + strerror(errno));
+		}
+		CheckpointRecord rec;
+		ssize_t n = read(fd, &rec, sizeof(rec));
+		close(fd);
+		if (n != static_cast<ssize_t>(sizeof(rec)) || memcmp(rec.magic, CHECKPOINT_MAGIC, sizeof(rec.magic))
+				|| rec.version != CHECKPOINT_VERSION || rec.size != sizeof(rec))
+			return fail(std::string(filename) + " is not a checkpoint file (or unsupported version)");
+		if (rec.checksum != checkpoint_checksum(&rec, offsetof(CheckpointRecord, checksum)))
+			return fail(std::string(filename) + ": checkpoint is corrupted (checksum mismatch)");
+		copy_data(data, rec.data);
+		return true;
+	}
+
+	bool missing() const { return not_found; }
+	const std::string& error() const { return err; }
+
+private:
+	// member-wise copy, keeps zeroed padding of dst
+	static void copy_data(CheckpointData& dst, const CheckpointData& src) {
+		copy_checkpoint_params(dst.params, src.params);
+		copy_checkpoint_state(dst.state, src.state);
+		dst.lineid = src.lineid;
+		dst.input_offset = src.input_offset;
+		dst.output_offset = src.output_offset;
+	}
+
+	bool fail(const std::string& message) {
+		err = message;
+		return false;
+	}
+
+	bool not_found = false;
+	std::string err;
+};
+
+
+// checkpoints embedded in a capture file
+class CaptureCheckpoints {
+public:
+	AlarmNoiseRejectParams params;
+	std::vector<CaptureCheckpoint> list;   // ascending rows
+
+	// embedded block with header and checksum
+	std::string serialize() const {
+		CaptureCheckpointsHeader h;
+		memset(static_cast<void*>(&h), 0, sizeof(h));
+		memcpy(h.magic, CAPTURE_CHECKPOINTS_MAGIC, sizeof(h.magic));
+		h.version = CAPTURE_CHECKPOINTS_VERSION;
+		h.record_size = sizeof(CaptureCheckpoint);
+		h.count = list.size();
+		copy_checkpoint_params(h.params, params);
+
+		std::string block(reinterpret_cast<const char*>(&h), sizeof(h));
+		for (const CaptureCheckpoint& c : list) {
+			CaptureCheckpoint rec;
+			memset(static_cast<void*>(&rec), 0, sizeof(rec));
+			rec.row = c.row;
+			rec.lineid = c.lineid;
+			copy_checkpoint_state(rec.state, c.state);
+			block.append(reinterpret_cast<const char*>(&rec), sizeof(rec));
+		}
+		uint64_t checksum = checkpoint_checksum(block.data(), block.size());
+		block.append(reinterpret_cast<const char*>(&checksum), sizeof(checksum));
+		return block;
+	}
+
+	// reads and verifies the embedded block, false with error message in error()
+	// (empty block: no checkpoints)
+	bool parse(std::string_view block) {
+		list.clear();
+		if (block.empty())
+			return true;
+		CaptureCheckpointsHeader h;
+		if (block.size() < sizeof(h) + sizeof(uint64_t))
+			return fail("embedded checkpoints are truncated");
+		memcpy(static_cast<void*>(&h), block.data(), sizeof(h));
+		if (memcmp(h.magic, CAPTURE_CHECKPOINTS_MAGIC, sizeof(h.magic)) || h.version != CAPTURE_CHECKPOINTS_VERSION
+				|| h.record_size != sizeof(CaptureCheckpoint))
+			return fail("embedded data are not checkpoints (or unsupported version)");
+		size_t len = block.size() - sizeof(uint64_t);
+		if (h.count != (len - sizeof(h)) / sizeof(CaptureCheckpoint) || (len - sizeof(h)) % sizeof(CaptureCheckpoint))
+			return fail("embedded checkpoints are truncated");
+		uint64_t checksum;
+		memcpy(&checksum, block.data() + len, sizeof(checksum));
+		if (checksum != checkpoint_checksum(block.data(), len))
+			return fail("embedded checkpoints are corrupted (checksum mismatch)");
+
+		params = h.params;
+		list.resize(h.count);
+		memcpy(static_cast<void*>(list.data()), block.data() + sizeof(h), h.count * sizeof(CaptureCheckpoint));
+		return true;
+	}
+
+	const std::string& error() const { return err; }
+
+private:
+	bool fail(const std::string& message) {
+		err = message;
+		list.clear();
+		return false;
+	}
+
+	std::string err;
+};
+
+#endif /* FP_CHECKPOINT_H_ */
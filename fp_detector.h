@@ -0,0 +1,519 @@
+//============================================================================
+// Name        : fp_detector.h
+// Description : alarm_noisereject detector as a reusable streaming class
+//============================================================================
+
+/*
+The detector keeps an average absolute difference between subsequent values
+(diffavg). If NUMBER_OF_POINTS_TO_ALARM subsequent differences are greater
+than diffavg * MULTIPLICATOR_TO_DETECT, alarm is raised and pattern starts.
+After the alarm, no alarm is detected for WAIT_STATE_USEC, pattern lasts for
+PATTERN_STATE_USEC. diffavg is not amended while waiting or while detection
+is in progress.
+
+Usage (e.g. embedded in acquisition):
+
+AlarmNoiseRejectDetector detector(params);
+...
+if (detector.sample()) {                  // sampling, see SAMPLE_EACH
+	AlarmNoiseRejectResult r = detector.push(t_usec, value);
+	if (r.isalarm) ...
+}
+
+or for data already in arrays (sampling is up to the caller):
+
+detector.process(t_usec, values, n, results);
+
+BasicAlarmNoiseRejectDetector<1, 5, 500> is the same detector with the given
+parameters fixed at compile time, dispatch_detector() picks a precompiled one
+matching the runtime parameters.
+
+With params.fixed_point, values are taken as int32 and diffavg is kept in
+fixed point (FIXED_AVGDIFF_BITS fractional bits, amended with rounding half
+away from zero) instead of float, so results are bit-exact on every platform
+and compiler and diffavg does not drift by accumulated float rounding on long
+runs. Decisions equal those of the float detector except where the float
+rounding of diffavg moves it across a threshold, curavg differs in the last
+printed digits. Values passed as int32_t (push(t_usec, int32_t), process() of
+int32_t arrays, used for int32 captures) are exact in the whole int32 range;
+float values (text, frames and shm input) are converted to int32, so they are
+exact up to 2^24 only. Amendment by runtime N_AMEND_AVGDIFF divides by a
+multiplication with a reciprocal computed once per detector.
+
+Header only, no I/O.
+ */
+
+#ifndef FP_DETECTOR_H_
+#define FP_DETECTOR_H_
+
+#include <iostream>
+#include <cstdint>
+#include <cstdlib>
+#include <cstddef>
+#include <cmath>
+
+// Value of the initial absolute difference between subsequent points representing noise
+// The value should be set based on real average value
+// This value is used as the initial value for avgdiff variable
+#define INITIAL_AVG_DIFF 200
+
+// How many subsequent points need to have greater difference between them
+// than avgdiff * MULTIPLICATOR_TO_DETECT to raise alarm
+#define NUMBER_OF_POINTS_TO_ALARM 5 // must be >= 1
+
+// How many microseconds must elapse between detected alarm to detect subsequent alarm
+// e.g. 5 secs = 5000000
+#define WAIT_STATE_USEC 1000000
+
+// Multiplicator to multiplicate diffavg value to set the threshold for alarm detection
+#define MULTIPLICATOR_TO_DETECT 10
+
+// Smoothing constant for subsequent diffavg amendments, must be >= 1
+// higher value means lower sensitivity to average diff value change
+#define N_AMEND_AVGDIFF 500
+
+// Sampling parameter: uses each nth input value for evaluation
+// If SAMPLE_EACH == 1, takes every value (no sampling)
+#define SAMPLE_EACH 1
+
+// Max pattern length: how long pattern recognition can last in microseconds
+// If PATTERN_STATE_USEC == 100000, takes 0.1 sec pattern
+#define PATTERN_STATE_USEC 250000
+
+// Number of samples whose differences are calculated at once by process()
+#define DETECTOR_BLOCK_SIZE 256
+
+// Fractional bits of diffavg of the fixed-point detector
+#define FIXED_AVGDIFF_BITS 16
+
+// true if the value is in the int32 range of the fixed-point detector input (false for NaN)
+inline bool fixed_point_value_valid(double v) {
+	return v >= -2147483648.0 && v < 2147483648.0;
+}
+
+// input value of the fixed-point detector, truncated toward zero; out of range values
+// saturate and NaN gives 0 (readers skip such values, see fixed_point_value_valid())
+inline int32_t fixed_point_value(float v) {
+	if (v >= 2147483648.f)
+		return INT32_MAX;
+	if (v >= -2147483648.f)
+		return static_cast<int32_t>(v);
+	return v < 0 ? INT32_MIN : 0;
+}
+
+inline int32_t fixed_point_value(int32_t v) { return v; }
+
+
+// detector parameters, in the order of program arguments
+struct AlarmNoiseRejectParams {
+	int sample_each = SAMPLE_EACH;
+	float initial_avg_diff = INITIAL_AVG_DIFF;
+	int number_of_points_to_alarm = NUMBER_OF_POINTS_TO_ALARM;
+	int wait_state_usec = WAIT_STATE_USEC;
+	int multiplicator_to_detect = MULTIPLICATOR_TO_DETECT;
+	int n_amend_avgdiff = N_AMEND_AVGDIFF;
+	int pattern_state_usec = PATTERN_STATE_USEC;
+
+	// integer values and fixed-point diffavg (not a program argument, see --arithmetic)
+	bool fixed_point = false;
+
+	// verify (somehow) values
+	bool valid() const {
+		return sample_each >= 1 &&
+			initial_avg_diff >= 1 &&
+			number_of_points_to_alarm >= 1 &&
+			wait_state_usec >= 1 &&
+			multiplicator_to_detect >= 1 &&
+			n_amend_avgdiff >= 1 &&
+			pattern_state_usec >= 1;
+	}
+
+	bool operator==(const AlarmNoiseRejectParams& o) const {
+		return sample_each == o.sample_each &&
+			initial_avg_diff == o.initial_avg_diff &&
+			number_of_points_to_alarm == o.number_of_points_to_alarm &&
+			wait_state_usec == o.wait_state_usec &&
+			multiplicator_to_detect == o.multiplicator_to_detect &&
+			n_amend_avgdiff == o.n_amend_avgdiff &&
+			pattern_state_usec == o.pattern_state_usec &&
+			fixed_point == o.fixed_point;
+	}
+
+	void print(std::ostream& os) const {
+		os << "sample_each: " << sample_each << std::endl;
+		os << "initial_avg_diff: " << initial_avg_diff << std::endl;
+		os << "number_of_points_to_alarm: " << number_of_points_to_alarm << std::endl;
+		os << "wait_state_usec: " << wait_state_usec << std::endl;
+		os << "multiplicator_to_detect: " << multiplicator_to_detect << std::endl;
+		os << "n_amend_avgdiff: " << n_amend_avgdiff << std::endl;
+		os << "pattern_state_usec: " << pattern_state_usec << std::endl;
+		if (fixed_point)
+			os << "arithmetic: fixed" << std::endl;
+	}
+};
+
+// result of one evaluated sample
+struct AlarmNoiseRejectResult {
+	float diff;        // difference from the previous value (not absolute)
+	float diffavg;     // average absolute difference after the sample
+	int patternid;     // sequential number of pattern, 0 if not in pattern
+	uint8_t isdetect;  // detection of alarm in progress
+	uint8_t isalarm;   // alarm raised
+	uint8_t iswait;    // waiting after alarm
+};
+
+// complete detector state (plain data, may be copied/stored)
+struct AlarmNoiseRejectState {
+	float diffavg;
+	float lastval;
+	int numthresholded;
+	int patternid;
+	int64_t alarmraisetime;
+	int64_t patternraisetime;
+	int cursample;
+	uint8_t isalarm;
+	uint8_t iswait;
+	uint8_t ispattern;
+	uint8_t started;   // at least one sample evaluated
+
+	// fixed-point detector only, instead of diffavg and lastval
+	int64_t diffavg_q; // diffavg * 2^FIXED_AVGDIFF_BITS
+	int32_t lastval_i;
+};
+
+
+// detector with optionally compile-time SAMPLE_EACH, NUMBER_OF_POINTS_TO_ALARM
+// and N_AMEND_AVGDIFF (0 = taken from params at runtime), float or fixed-point
+template <int SampleEach = 0, int NumberOfPointsToAlarm = 0, int NAmendAvgdiff = 0, bool FixedPoint = false>
+class BasicAlarmNoiseRejectDetector {
+public:
+	explicit BasicAlarmNoiseRejectDetector(const AlarmNoiseRejectParams& params = AlarmNoiseRejectParams())
+		: p(params) {
+		reciprocal_changed();
+		reset();
+	}
+
+	// true if compile-time parameters equal those of params
+	static bool matches(const AlarmNoiseRejectParams& params) {
+		return (!SampleEach || SampleEach == params.sample_each) &&
+			(!NumberOfPointsToAlarm || NumberOfPointsToAlarm == params.number_of_points_to_alarm) &&
+			(!NAmendAvgdiff || NAmendAvgdiff == params.n_amend_avgdiff) &&
+			FixedPoint == params.fixed_point;
+	}
+
+	// sets initial state
+	void reset() {
+		s.diffavg = p.initial_avg_diff;
+		s.lastval = 0;
+		s.numthresholded = number_of_points_to_alarm();
+		s.patternid = 0;
+		s.alarmraisetime = 0;     // small enough
+		s.patternraisetime = 0;   // small enough
+		s.cursample = sample_each();
+		s.isalarm = 0;
+		s.iswait = 0;
+		s.ispattern = 0;
+		s.started = 0;
+		s.diffavg_q = FixedPoint ? std::llround(static_cast<double>(p.initial_avg_diff) * (1 << FIXED_AVGDIFF_BITS)) : 0;
+		s.lastval_i = 0;
+		diffavg_changed();
+	}
+
+	// sampling: true if current input sample is to be evaluated by push()
+	bool sample() {
+		if (SampleEach == 1)
+			return true;
+		if (s.cursample-- > 1)
+			return false;
+		s.cursample = sample_each();
+		return true;
+	}
+
+	// evaluates sample with time in microseconds
+	AlarmNoiseRejectResult push(int64_t t_usec, float curval) {
+		if (FixedPoint)
+			return push_fixed(t_usec, fixed_point_value(curval));
+
+		// copies last value for the first sample
+		if (!s.started) {
+			s.lastval = curval;
+			s.started = 1;
+		}
+
+		float diffnoabs = curval - s.lastval;
+
+		// remember current value
+		s.lastval = curval;
+
+		return step(t_usec, diffnoabs, abs_diff(diffnoabs));
+	}
+
+	// evaluates sample of an integer value, the fixed-point detector takes it without
+	// conversion to float (exact in the whole int32 range)
+	AlarmNoiseRejectResult push(int64_t t_usec, int32_t curval) {
+		if (FixedPoint)
+			return push_fixed(t_usec, curval);
+		return push(t_usec, static_cast<float>(curval));
+	}
+
+	// evaluates n samples from contiguous arrays, results to out[0..n-1]
+	// same as calling push() for each sample
+	// (no prescan of quiet samples as in fp_multichannel.h, the diffavg recurrence bounds the loop)
+	void process(const int64_t* t_usec, const float* values, size_t n, AlarmNoiseRejectResult* out) {
+		if (FixedPoint) {
+			process_fixed(t_usec, values, n, out);
+			return;
+		}
+
+		float diffnoabs[DETECTOR_BLOCK_SIZE];
+		float diff[DETECTOR_BLOCK_SIZE];
+
+		for (size_t base = 0; base < n; base += DETECTOR_BLOCK_SIZE) {
+			const float* v = values + base;
+			size_t m = (n - base < DETECTOR_BLOCK_SIZE) ? n - base : DETECTOR_BLOCK_SIZE;
+
+			if (!s.started) {
+				s.lastval = v[0];
+				s.started = 1;
+			}
+
+			// differences of the whole block first (vectorizable)
+			diffnoabs[0] = v[0] - s.lastval;
+			for (size_t i = 1; i < m; i++)
+				diffnoabs[i] = v[i] - v[i - 1];
+			for (size_t i = 0; i < m; i++)
+				diff[i] = abs_diff(diffnoabs[i]);
+			s.lastval = v[m - 1];
+
+			// state machine
+			for (size_t i = 0; i < m; i++)
+				out[base + i] = step(t_usec[base + i], diffnoabs[i], diff[i]);
+		}
+	}
+
+	// process() of integer values, see push(int64_t, int32_t)
+	void process(const int64_t* t_usec, const int32_t* values, size_t n, AlarmNoiseRejectResult* out) {
+		if (FixedPoint) {
+			process_fixed(t_usec, values, n, out);
+			return;
+		}
+		float v[DETECTOR_BLOCK_SIZE];
+		for (size_t base = 0; base < n; base += DETECTOR_BLOCK_SIZE) {
+			size_t m = (n - base < DETECTOR_BLOCK_SIZE) ? n - base : DETECTOR_BLOCK_SIZE;
+			for (size_t i = 0; i < m; i++)
+				v[i] = values[base + i];
+			process(t_usec + base, v, m, out + base);
+		}
+	}
+
+	const AlarmNoiseRejectParams& params() const { return p; }
+
+	const AlarmNoiseRejectState& state() const { return s; }
+	void set_state(const AlarmNoiseRejectState& state) {
+		s = state;
+		diffavg_changed();
+	}
+
+private:
+	// parameters, constants if given by template arguments
+	int sample_each() const { return SampleEach ? SampleEach : p.sample_each; }
+	int number_of_points_to_alarm() const { return NumberOfPointsToAlarm ? NumberOfPointsToAlarm : p.number_of_points_to_alarm; }
+	int n_amend_avgdiff() const { return NAmendAvgdiff ? NAmendAvgdiff : p.n_amend_avgdiff; }
+
+	// calculate diff as abs value
+	// (truncated to integer, as measured values are integer counts)
+	static float abs_diff(float diffnoabs) {
+		return std::abs(static_cast<int>(diffnoabs));
+	}
+
+	AlarmNoiseRejectResult push_fixed(int64_t t_usec, int32_t curval) {
+		if (!s.started) {
+			s.lastval_i = curval;
+			s.started = 1;
+		}
+		int64_t diffnoabs = static_cast<int64_t>(curval) - s.lastval_i;
+		s.lastval_i = curval;
+		return step(t_usec, diffnoabs, diffnoabs < 0 ? -diffnoabs : diffnoabs);
+	}
+
+	// process() of the fixed-point detector, values are converted to int32
+	template <class Value>
+	void process_fixed(const int64_t* t_usec, const Value* values, size_t n, AlarmNoiseRejectResult* out) {
+		int32_t v[DETECTOR_BLOCK_SIZE];
+		int64_t diffnoabs[DETECTOR_BLOCK_SIZE];
+		int64_t diff[DETECTOR_BLOCK_SIZE];
+
+		for (size_t base = 0; base < n; base += DETECTOR_BLOCK_SIZE) {
+			size_t m = (n - base < DETECTOR_BLOCK_SIZE) ? n - base : DETECTOR_BLOCK_SIZE;
+			for (size_t i = 0; i < m; i++)
+				v[i] = fixed_point_value(values[base + i]);
+
+			if (!s.started) {
+				s.lastval_i = v[0];
+				s.started = 1;
+			}
+
+			// differences of the whole block first (vectorizable)
+			diffnoabs[0] = static_cast<int64_t>(v[0]) - s.lastval_i;
+			for (size_t i = 1; i < m; i++)
+				diffnoabs[i] = static_cast<int64_t>(v[i]) - v[i - 1];
+			for (size_t i = 0; i < m; i++)
+				diff[i] = diffnoabs[i] < 0 ? -diffnoabs[i] : diffnoabs[i];
+			s.lastval_i = v[m - 1];
+
+			for (size_t i = 0; i < m; i++)
+				out[base + i] = step(t_usec[base + i], diffnoabs[i], diff[i]);
+		}
+	}
+
+	// true if diff is below multiplicator_to_detect * diffavg
+	bool below_threshold(float diff) const {
+		return diff < p.multiplicator_to_detect * s.diffavg;
+	}
+
+	bool below_threshold(int64_t diff) const {
+		return (diff << FIXED_AVGDIFF_BITS) < threshold_q;
+	}
+
+	// moves diffavg towards diff by 1 / N_AMEND_AVGDIFF
+	void amend(float diff) {
+		s.diffavg = (s.diffavg * (n_amend_avgdiff() - 1) + diff) / n_amend_avgdiff();
+	}
+
+	// (diffavg * (n - 1) + diff) / n as diffavg + (diff - diffavg) / n, rounded half away from zero
+	// (division by compile-time N_AMEND_AVGDIFF is a multiplication by reciprocal, by runtime
+	// one a multiplication by the precomputed reciprocal_m, see reciprocal_changed())
+	void amend(int64_t diff) {
+		int64_t d = (diff << FIXED_AVGDIFF_BITS) - s.diffavg_q;
+		int64_t n = n_amend_avgdiff();
+		int64_t sign = d >> 63;                     // 0 or -1, no branch
+		if (NAmendAvgdiff) {
+			int64_t half = ((n / 2) ^ sign) - sign;     // n / 2 with the sign of d
+			s.diffavg_q += (d + half) / n;              // division truncates towards zero
+		} else {
+			// |d| + n / 2 divided by n, with the sign of d
+			uint64_t x = ((d ^ sign) - sign) + n / 2;
+			int64_t q = static_cast<int64_t>((static_cast<unsigned __int128>(x) * reciprocal_m) >> reciprocal_shift);
+			s.diffavg_q += (q ^ sign) - sign;
+		}
+		diffavg_changed();
+	}
+
+	// reciprocal of runtime N_AMEND_AVGDIFF: x / n == (x * reciprocal_m) >> reciprocal_shift
+	// for every x < 2^63 (reciprocal_m = ceil(2^shift / n), shift = 63 + ceil(log2(n)))
+	void reciprocal_changed() {
+		uint64_t n = p.n_amend_avgdiff > 0 ? p.n_amend_avgdiff : 1;
+		int log2n = 0;
+		while ((uint64_t(1) << log2n) < n)
+			log2n++;
+		reciprocal_shift = 63 + log2n;
+		reciprocal_m = static_cast<uint64_t>(((static_cast<unsigned __int128>(1) << reciprocal_shift) - 1) / n + 1);
+	}
+
+	// updates values derived from fixed-point diffavg: threshold and diffavg of results
+	void diffavg_changed() {
+		if (!FixedPoint)
+			return;
+		if (__builtin_mul_overflow(static_cast<int64_t>(p.multiplicator_to_detect), s.diffavg_q, &threshold_q))
+			threshold_q = INT64_MAX;
+		diffavg_out = static_cast<float>(static_cast<double>(s.diffavg_q) / (1 << FIXED_AVGDIFF_BITS));
+	}
+
+	float diffavg() const { return FixedPoint ? diffavg_out : s.diffavg; }
+
+	// state machine for one sample with known difference from the previous value
+	// (Diff is float for the float detector, int64_t for the fixed-point one)
+	template <class Diff>
+	AlarmNoiseRejectResult step(int64_t t_usec, Diff diffnoabs, Diff diff) {
+		// pattern evaluation
+		if (s.ispattern == 1) {
+			if (t_usec - s.patternraisetime > p.pattern_state_usec)
+				s.ispattern = 0; // reset pattern period
+		}
+
+		//verify if waiting period after previously detected alarm
+		if (s.iswait == 1) {
+			// after entering the wait state, reset the alarm status
+			s.isalarm = 0;
+
+			if (t_usec - s.alarmraisetime > p.wait_state_usec)
+				s.iswait = 0; // reset wait period
+
+		} else {
+
+			if (below_threshold(diff))
+				s.numthresholded = number_of_points_to_alarm(); //reset thresholding count
+			else {
+				// if number of subsequent points is enough, raise alarm
+				if (--s.numthresholded == 0) {
+					// alarm raised
+					s.isalarm = 1;
+					s.alarmraisetime = t_usec;
+					s.iswait = 1;
+					s.numthresholded = number_of_points_to_alarm();
+
+					// pattern starts
+					s.patternid++;
+					s.ispattern = 1;
+					s.patternraisetime = t_usec;
+				}
+			}
+		}
+
+		// amend diffavg, use N_AMEND_AVGDIFF
+		// do not amend if in wait state of detection sequence based on number_of_points_to_alarm
+		if (s.iswait == 0 && s.numthresholded == number_of_points_to_alarm())
+			amend(diff);
+
+		AlarmNoiseRejectResult r;
+		r.diff = diffnoabs;
+		r.diffavg = diffavg();
+		r.patternid = s.ispattern ? s.patternid : 0;
+		r.isdetect = s.numthresholded != number_of_points_to_alarm();
+		r.isalarm = s.isalarm;
+		r.iswait = s.iswait;
+		return r;
+	}
+
+	AlarmNoiseRejectParams p;
+	AlarmNoiseRejectState s;
+
+	// fixed-point detector, see diffavg_changed()
+	int64_t threshold_q = 0;
+	uint64_t reciprocal_m = 0;
+	int reciprocal_shift = 0;
+	float diffavg_out = 0;
+};
+
+// detector with all parameters at runtime
+typedef BasicAlarmNoiseRejectDetector<> AlarmNoiseRejectDetector;
+typedef BasicAlarmNoiseRejectDetector<0, 0, 0, true> FixedAlarmNoiseRejectDetector;
+
+
+// Additional precompiled configuration SAMPLE_EACH,NUMBER_OF_POINTS_TO_ALARM,N_AMEND_AVGDIFF
+// of production deployments, e.g. -DFP_FIXED_DETECTOR_CONFIG=1,5,512
+// #define FP_FIXED_DETECTOR_CONFIG 1,5,512
+
+// calls f(detector) with the detector specialized for params, if precompiled,
+// else with AlarmNoiseRejectDetector; returns the result of f
+template <class F>
+inline auto dispatch_detector(const AlarmNoiseRejectParams& params, F&& f) {
+	if (params.fixed_point) {
+		if (BasicAlarmNoiseRejectDetector<SAMPLE_EACH, NUMBER_OF_POINTS_TO_ALARM, N_AMEND_AVGDIFF, true>::matches(params))
+			return f(BasicAlarmNoiseRejectDetector<SAMPLE_EACH, NUMBER_OF_POINTS_TO_ALARM, N_AMEND_AVGDIFF, true>(params));
+		return f(FixedAlarmNoiseRejectDetector(params));
+	}
+#ifdef FP_FIXED_DETECTOR_CONFIG
+	if (BasicAlarmNoiseRejectDetector<FP_FIXED_DETECTOR_CONFIG>::matches(params))
+		return f(BasicAlarmNoiseRejectDetector<FP_FIXED_DETECTOR_CONFIG>(params));
+#endif
+	// defaults
+	if (BasicAlarmNoiseRejectDetector<SAMPLE_EACH, NUMBER_OF_POINTS_TO_ALARM, N_AMEND_AVGDIFF>::matches(params))
+		return f(BasicAlarmNoiseRejectDetector<SAMPLE_EACH, NUMBER_OF_POINTS_TO_ALARM, N_AMEND_AVGDIFF>(params));
+	// no sampling, other parameters at runtime
+	if (BasicAlarmNoiseRejectDetector<1>::matches(params))
+		return f(BasicAlarmNoiseRejectDetector<1>(params));
+	return f(AlarmNoiseRejectDetector(params));
+}
+
+#endif /* FP_DETECTOR_H_ */
@@ -0,0 +1,165 @@
+//============================================================================
+// Name        : fp_events.h
+// Description : Events-only output of detection results
+//============================================================================
+
+/*
+Instead of one line per sample, only transitions are output:
+
+event;lineid;timestamp;patternid;start_lineid;start_timestamp;samples;meas;curavg
+
+alarm        alarm raised, pattern patternid starts at this sample
+pattern_end  pattern patternid ended, lineid/timestamp is its last sample,
+             start_lineid/start_timestamp its first one, samples the number
+             of evaluated samples within the pattern
+heartbeat    (optional) current state every heartbeat_usec of input time
+
+lineid, timestamp, meas and curavg are those of the sample the event refers to,
+start_lineid, start_timestamp and samples are empty except for pattern_end.
+A pattern still in progress at the end of input is not reported as ended.
+Events of more channels (--channels N) follow the same pattern_end convention.
+With set_prefix(), each event row starts with the given text (e.g. "stream;"
+columns when events of more streams share one output).
+
+AlarmNotifier writes alarm events (in the same format) to a separate
+descriptor by one write() each, as soon as a batch of samples is evaluated
+and before its output rows are formatted, e.g. for --alarm-fd 3 next to
+buffered per-sample output.
+ */
+
+#ifndef FP_EVENTS_H_
+#define FP_EVENTS_H_
+
+#include <string>
+#include <string_view>
+#include <cstdint>
+
+#include "fp_detector.h"
+#include "fp_writer.h"
+
+// Size of the buffer of AlarmNotifier, one row is written at a time
+#define ALARM_BUFFER_SIZE 4096
+
+class EventWriter {
+public:
+	// heartbeat_usec: period of heartbeat events in input time, 0 for none
+	EventWriter(OutputWriter& out, int64_t heartbeat_usec = 0) : out(out), heartbeat_usec(heartbeat_usec) {}
+
+	void header() {
+		out.put("event;lineid;timestamp;patternid;start_lineid;start_timestamp;samples;meas;curavg");
+		out.end_row();
+	}
+
+	// text put before each event row
+	void set_prefix(std::string_view text) { prefix = text; }
+
+	// processes evaluated sample, timestamp() returns its text (called only when needed)
+	template <class TimestampText>
+	void add(long long lineid, int64_t t_usec, float meas, const AlarmNoiseRejectResult& r, TimestampText timestamp) {
+		if (r.patternid != patternid) {
+			if (patternid)
+				write_pattern_end();
+			patternid = r.patternid;
+			if (patternid) {
+				start_lineid = lineid;
+				start_timestamp = timestamp();
+				samples = 0;
+			}
+		}
+
+		if (r.isalarm)
+			write_event("alarm", lineid, timestamp(), meas, r.diffavg, true);
+
+		// last sample of the pattern so far
+		if (patternid) {
+			samples++;
+			last_lineid = lineid;
+			last_timestamp = timestamp();
+			last_meas = meas;
+			last_diffavg = r.diffavg;
+		}
+
+		if (heartbeat_usec) {
+			if (!heartbeat_started) {
+				heartbeat_time = t_usec;
+				heartbeat_started = true;
+			} else if (t_usec - heartbeat_time >= heartbeat_usec) {
+				write_event("heartbeat", lineid, timestamp(), meas, r.diffavg, false);
+				heartbeat_time = t_usec;
+			}
+		}
+	}
+
+private:
+	// event without pattern range
+	void write_event(const char* event, long long lineid, std::string_view timestamp, float meas, float diffavg, bool alarm) {
+		out.put(prefix);
+		out.put(event); out.put(';');
+		out.put_int(lineid); out.put(';'); out.put(timestamp); out.put(';');
+		out.put_int(patternid); out.put(";;;;");
+		out.put_float(meas); out.put(';'); out.put_float(diffavg);
+		out.end_row(alarm);
+	}
+
+	void write_pattern_end() {
+		out.put(prefix);
+		out.put("pattern_end;");
+		out.put_int(last_lineid); out.put(';'); out.put(last_timestamp); out.put(';');
+		out.put_int(patternid); out.put(';');
+		out.put_int(start_lineid); out.put(';'); out.put(start_timestamp); out.put(';');
+		out.put_int(samples); out.put(';');
+		out.put_float(last_meas); out.put(';'); out.put_float(last_diffavg);
+		out.end_row();
+	}
+
+	OutputWriter& out;
+	int64_t heartbeat_usec;
+	std::string prefix;
+
+	// pattern in progress (0 if none)
+	int patternid = 0;
+	long long start_lineid = 0;
+	std::string start_timestamp;
+	long long samples = 0;
+	long long last_lineid = 0;
+	std::string last_timestamp;
+	float last_meas = 0, last_diffavg = 0;
+
+	// input time of the last heartbeat
+	bool heartbeat_started = false;
+	int64_t heartbeat_time = 0;
+};
+
+
+class AlarmNotifier {
+public:
+	explicit AlarmNotifier(int fd) : out(fd, FLUSH_LINE, ALARM_BUFFER_SIZE) {}
+
+	void header() {
+		out.put("event;lineid;timestamp;patternid;start_lineid;start_timestamp;samples;meas;curavg");
+		out.end_row();
+	}
+
+	// writes alarms of n evaluated samples starting with first_lineid
+	// timestamp(i) returns text of sample i (called for alarms only)
+	template <class TimestampText>
+	void add(long long first_lineid, const float* meas, const AlarmNoiseRejectResult* r, size_t n, TimestampText timestamp) {
+		for (size_t i = 0; i < n; i++) {
+			if (!r[i].isalarm)
+				continue;
+			out.put("alarm;");
+			out.put_int(first_lineid + i); out.put(';'); out.put(timestamp(i)); out.put(';');
+			out.put_int(r[i].patternid); out.put(";;;;");
+			out.put_float(meas[i]); out.put(';'); out.put_float(r[i].diffavg);
+			out.end_row(true);
+		}
+	}
+
+	bool failed() const { return out.failed(); }
+	int error() const { return out.error(); }
+
+private:
+	OutputWriter out;
+};
+
+#endif /* FP_EVENTS_H_ */
@@ -0,0 +1,478 @@
+//============================================================================
+// Name        : fp_generate_data.cpp
+// Description : Synthetic sensor data with injected ground-truth patterns
+//============================================================================
+
+/*
+Generates input data for fp_generate_patterns, e.g.:
+
+./fp_generate_data --rows 100000000 --labels labels.csv | ./fp_generate_patterns --output events
+
+Samples are taken at --rate per second, values are base + drift * time + noise
+(whole numbers as from a counter). Randomly, time gaps are inserted and bursts
+of a given shape (see fp_synth.h) are added to the values. Every burst and gap
+is written to the label file:
+
+event;channel;lineid;timestamp;shape;samples;amplitude;gap_usec
+
+event is burst or gap (after the line lineid), lineid is the number of the
+line (row) within the output, starting with 1.
+
+Rows are generated in chunks by --threads worker threads and written in order,
+the output does not depend on the number of threads. Gaps and bursts are
+planned by the writing thread, so the labels are known before the data.
+
+options:
+--rows N                  number of rows, default 1000000, 0 for an endless stream
+--channels N              values per row, default 1
+--rate HZ                 samples per second, default 15625 (64 usec)
+--start TIMESTAMP         first timestamp, default "10-03-2016 15:27:00.000000"
+--base V                  mean value, default 69000
+--noise V                 noise amplitude (+-), default 150
+--drift V                 change of mean value per second, default 0
+--gap-probability P       probability of gap after each row, default 0
+--gap-usec N              length of gaps, default 1000000
+--burst-probability P     probability of burst start per row and channel, default 0.00001
+--burst-length N          samples of a burst, default 32
+--burst-amplitude V       amplitude of bursts, default 50000
+--burst-shapes LIST       shapes chosen randomly, default noise,sine,ringing
+--seed N                  random seed, default 1
+--format F                csv (default), frames (see --input-format frames) or capture
+                          (see fp_capture.h, needs --out)
+--out FILE                output file, default stdout
+--labels FILE             label file, default none
+--threads N               worker threads, default number of CPUs
+ */
+
+#include <iostream>
+#include <string>
+#include <vector>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <cstdlib>
+#include <cstring>
+#include <csignal>
+#include <cmath>
+#include <fcntl.h>
+#include <unistd.h>
+
+#include "fp_capture.h"
+#include "fp_synth.h"
+#include "fp_timestamp.h"
+#include "fp_writer.h"
+
+// Rows generated at once by one worker
+#define GENERATOR_CHUNK_ROWS 65536
+
+enum OutputFormat { FORMAT_CSV, FORMAT_FRAMES, FORMAT_CAPTURE };
+
+struct GeneratorOptions {
+	unsigned long long rows = 1000000;
+	size_t channels = 1;
+	double rate = 15625;
+	int64_t start_usec = 1457623620000000LL;
+	double base = 69000;
+	double noise = 150;
+	double drift = 0;
+	double gap_probability = 0;
+	int64_t gap_usec = 1000000;
+	double burst_probability = 0.00001;
+	int burst_length = 32;
+	double burst_amplitude = 50000;
+	std::vector<BurstShape> burst_shapes = { BURST_NOISE, BURST_SINE, BURST_RINGING };
+	uint64_t seed = 1;
+	OutputFormat format = FORMAT_CSV;
+	const char* out_file = nullptr;
+	const char* labels_file = nullptr;
+	unsigned threads = std::thread::hardware_concurrency();
+};
+
+struct Burst {
+	size_t channel;
+	uint64_t first_row;   // 0-based
+	int length;
+	BurstShape shape;
+	double amplitude;
+};
+
+// rows planned by the writing thread and generated by a worker
+struct Chunk {
+	enum State { EMPTY, PLANNED, DONE } state = EMPTY;
+	uint64_t index = 0;
+	uint64_t first_row = 0;
+	size_t rows = 0;
+	int64_t t0 = 0;                  // time of the first row
+	std::vector<uint64_t> gaps;      // gap after these rows
+	std::vector<Burst> bursts;       // bursts overlapping the chunk
+
+	// generated data
+	std::string text;                // csv or frames
+	std::vector<int64_t> t;          // capture
+	std::vector<double> values;      // capture, rows x channels
+};
+
+
+class Generator {
+public:
+	explicit Generator(const GeneratorOptions& opts) : o(opts), planner(opts.seed) {
+		period_usec = std::llround(1e6 / o.rate);
+		next_t = o.start_usec;
+		next_gap = o.gap_probability > 0 ? planner.geometric(o.gap_probability) : UINT64_MAX;
+		for (size_t c = 0; c < o.channels; c++)
+			next_burst.push_back(o.burst_probability > 0 ? planner.geometric(o.burst_probability) : UINT64_MAX);
+	}
+
+	// plans next chunk (gaps and bursts), labels are appended to labels, false at the end
+	bool plan(Chunk& chunk, std::string& labels) {
+		if (o.rows && next_row >= o.rows)
+			return false;
+
+		chunk.index = chunk_index++;
+		chunk.first_row = next_row;
+		chunk.rows = GENERATOR_CHUNK_ROWS;
+		if (o.rows && o.rows - next_row < chunk.rows)
+			chunk.rows = o.rows - next_row;
+		chunk.t0 = next_t;
+		uint64_t end = chunk.first_row + chunk.rows;
+
+		chunk.gaps.clear();
+		for (; next_gap < end; next_gap += 1 + planner.geometric(o.gap_probability)) {
+			chunk.gaps.push_back(next_gap);
+			label(labels, "gap", 0, next_gap, row_time(chunk, next_gap), "", 0, 0, o.gap_usec);
+		}
+
+		// bursts still running and those starting in this chunk, one at a time per channel
+		chunk.bursts.clear();
+		for (const Burst& b : active)
+			if (b.first_row + b.length > chunk.first_row)
+				chunk.bursts.push_back(b);
+		for (size_t c = 0; c < o.channels; c++) {
+			while (next_burst[c] < end) {
+				Burst b;
+				b.channel = c;
+				b.first_row = next_burst[c];
+				b.length = o.burst_length;
+				b.shape = o.burst_shapes[planner.next() % o.burst_shapes.size()];
+				b.amplitude = o.burst_amplitude;
+				chunk.bursts.push_back(b);
+				label(labels, "burst", c, b.first_row, row_time(chunk, b.first_row), burst_shape_name(b.shape),
+						b.length, b.amplitude, 0);
+				next_burst[c] = b.first_row + b.length + planner.geometric(o.burst_probability);
+			}
+		}
+		active = chunk.bursts;
+
+		next_row = end;
+		next_t = chunk.t0 + chunk.rows * period_usec + chunk.gaps.size() * o.gap_usec;
+		chunk.state = Chunk::PLANNED;
+		return true;
+	}
+
+	// generates rows of planned chunk (may run in parallel for different chunks)
+	void generate(Chunk& chunk) const {
+		// noise of each chunk has its own random sequence
+		SynthRandom rng(o.seed * 0x9E3779B97F4A7C15ULL + chunk.index + 1);
+		std::vector<float> row(o.channels);
+		std::vector<double> values(o.channels);
+
+		chunk.text.clear();
+		chunk.t.clear();
+		chunk.values.clear();
+
+		size_t gap = 0;
+		int64_t t = chunk.t0;
+		for (size_t i = 0; i < chunk.rows; i++) {
+			uint64_t r = chunk.first_row + i;
+
+			double level = o.base + o.drift * (t - o.start_usec) * 1e-6;
+			for (size_t c = 0; c < o.channels; c++)
+				values[c] = level + o.noise * (2 * rng.uniform() - 1);
+			for (const Burst& b : chunk.bursts)
+				if (r >= b.first_row && r < b.first_row + b.length)
+					values[b.channel] += burst_offset(b.shape, r - b.first_row, b.length, b.amplitude, rng.uniform());
+			for (size_t c = 0; c < o.channels; c++) {
+				values[c] = std::round(values[c]);
+				row[c] = values[c];
+			}
+
+			switch (o.format) {
+			case FORMAT_CSV:
+				synth_line(t, row.data(), o.channels, 0, chunk.text);
+				break;
+			case FORMAT_FRAMES:
+				chunk.text.append(reinterpret_cast<const char*>(&t), sizeof(t));
+				chunk.text.append(reinterpret_cast<const char*>(row.data()), o.channels * sizeof(float));
+				break;
+			case FORMAT_CAPTURE:
+				chunk.t.push_back(t);
+				chunk.values.insert(chunk.values.end(), values.begin(), values.end());
+				break;
+			}
+
+			t += period_usec;
+			if (gap < chunk.gaps.size() && chunk.gaps[gap] == r) {
+				t += o.gap_usec;
+				gap++;
+			}
+		}
+	}
+
+private:
+	// time of row within planned chunk
+	int64_t row_time(const Chunk& chunk, uint64_t row) const {
+		int64_t t = chunk.t0 + (row - chunk.first_row) * period_usec;
+		for (uint64_t g : chunk.gaps)
+			if (g < row)
+				t += o.gap_usec;
+		return t;
+	}
+
+	void label(std::string& labels, const char* event, size_t channel, uint64_t row, int64_t t,
+			const char* shape, int samples, double amplitude, int64_t gap_usec) const {
+		if (!o.labels_file)
+			return;
+		char ts[TIMESTAMP_TEXT_LEN];
+		format_timestamp(t, 0, ts);
+		labels += event;
+		labels += ';' + std::to_string(channel) + ';' + std::to_string(row + 1) + ';';
+		labels.append(ts, TIMESTAMP_TEXT_LEN);
+		labels += ';';
+		labels += shape;
+		labels += ';' + std::to_string(samples) + ';' + std::to_string(static_cast<long long>(amplitude)) +
+				';' + std::to_string(gap_usec) + '\n';
+	}
+
+	const GeneratorOptions& o;
+	SynthRandom planner;
+	int64_t period_usec;
+	uint64_t chunk_index = 0;
+	uint64_t next_row = 0;
+	int64_t next_t;
+	uint64_t next_gap;
+	std::vector<uint64_t> next_burst;
+	std::vector<Burst> active;
+};
+
+
+// parses options, false (with a message) on error
+static bool parse_generator_options(int argc, char* argv[], GeneratorOptions& o) {
+	for (int i = 1; i < argc; i++) {
+		std::string arg = argv[i];
+		if (i + 1 >= argc) {
+			std::cerr << "Missing value of option " << arg << std::endl;
+			return false;
+		}
+		const char* value = argv[++i];
+		char* endp = nullptr;
+		bool ok = true;
+
+		if (arg == "--rows")
+			o.rows = strtoull(value, &endp, 10);
+		else if (arg == "--channels")
+			ok = (o.channels = strtoul(value, &endp, 10)) >= 1;
+		else if (arg == "--rate")
+			ok = (o.rate = strtod(value, &endp)) > 0 && o.rate <= 1e6;
+		else if (arg == "--start") {
+			TimestampDecoder decoder;
+			ok = decoder.decode(value, o.start_usec);
+		} else if (arg == "--base")
+			o.base = strtod(value, &endp);
+		else if (arg == "--noise")
+			o.noise = strtod(value, &endp);
+		else if (arg == "--drift")
+			o.drift = strtod(value, &endp);
+		else if (arg == "--gap-probability")
+			ok = (o.gap_probability = strtod(value, &endp)) >= 0 && o.gap_probability <= 1;
+		else if (arg == "--gap-usec")
+			ok = (o.gap_usec = strtoll(value, &endp, 10)) >= 0;
+		else if (arg == "--burst-probability")
+			ok = (o.burst_probability = strtod(value, &endp)) >= 0 && o.burst_probability <= 1;
+		else if (arg == "--burst-length")
+			ok = (o.burst_length = strtol(value, &endp, 10)) >= 1;
+		else if (arg == "--burst-amplitude")
+			o.burst_amplitude = strtod(value, &endp);
+		else if (arg == "--burst-shapes") {
+			o.burst_shapes.clear();
+			std::string list = value;
+			size_t start = 0;
+			for (;;) {
+				size_t comma = list.find(',', start);
+				BurstShape shape;
+				if (!parse_burst_shape(list.substr(start, comma - start), shape)) {
+					ok = false;
+					break;
+				}
+				o.burst_shapes.push_back(shape);
+				if (comma == std::string::npos)
+					break;
+				start = comma + 1;
+			}
+		} else if (arg == "--seed")
+			o.seed = strtoull(value, &endp, 10);
+		else if (arg == "--format") {
+			if (!strcmp(value, "csv"))
+				o.format = FORMAT_CSV;
+			else if (!strcmp(value, "frames"))
+				o.format = FORMAT_FRAMES;
+			else if (!strcmp(value, "capture"))
+				o.format = FORMAT_CAPTURE;
+			else
+				ok = false;
+		} else if (arg == "--out")
+			o.out_file = value;
+		else if (arg == "--labels")
+			o.labels_file = value;
+		else if (arg == "--threads")
+			ok = (o.threads = strtoul(value, &endp, 10)) >= 1;
+		else {
+			std::cerr << "Unknown option: " << arg << std::endl;
+			return false;
+		}
+
+		if (!ok || (endp && (*value == '\0' || *endp != '\0'))) {
+			std::cerr << "Invalid value of option " << arg << ": " << value << std::endl;
+			return false;
+		}
+	}
+
+	if (o.threads < 1)
+		o.threads = 1;
+	if (o.format == FORMAT_CAPTURE && (!o.out_file || !o.rows)) {
+		std::cerr << "Capture format needs --out FILE and --rows N > 0" << std::endl;
+		return false;
+	}
+	return true;
+}
+
+// opens output file, -1 (with a message) on error
+static int open_output(const char* filename) {
+	int fd = open(filename, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+	if (fd < 0)
+		std::cerr << "Cannot open " << filename << ": " << strerror(errno) << std::endl;
+	return fd;
+}
+
+
+int main(int argc, char* argv[]) {
+	GeneratorOptions opts;
+	if (!parse_generator_options(argc, argv, opts))
+		return 1;
+
+	// a closed pipe ends the stream (write error)
+	signal(SIGPIPE, SIG_IGN);
+
+	int out_fd = STDOUT_FILENO;
+	CaptureWriter capture;
+	if (opts.format == FORMAT_CAPTURE) {
+		if (!capture.create(opts.out_file, opts.channels, CAPTURE_INT32, 0)) {
+			std::cerr << capture.error() << std::endl;
+			return 1;
+		}
+	} else if (opts.out_file && (out_fd = open_output(opts.out_file)) < 0)
+		return 1;
+	OutputWriter out(out_fd, FLUSH_BLOCK);
+
+	int labels_fd = -1;
+	if (opts.labels_file && (labels_fd = open_output(opts.labels_file)) < 0)
+		return 1;
+	OutputWriter labels_out(labels_fd, FLUSH_EXIT);
+	std::string labels = "event;channel;lineid;timestamp;shape;samples;amplitude;gap_usec\n";
+
+	Generator generator(opts);
+
+	// chunks in flight, chunk i uses slot i % size
+	std::vector<Chunk> slots(opts.threads * 2);
+	std::mutex mutex;
+	std::condition_variable changed;
+	uint64_t planned = 0, to_generate = 0;
+	bool finished = false;   // all chunks planned (or stopped)
+
+	std::vector<std::thread> workers;
+	for (unsigned i = 0; i < opts.threads; i++) {
+		workers.emplace_back([&] {
+			std::unique_lock<std::mutex> lock(mutex);
+			for (;;) {
+				changed.wait(lock, [&] { return to_generate < planned || finished; });
+				if (to_generate == planned)
+					return;
+				Chunk& chunk = slots[to_generate++ % slots.size()];
+				lock.unlock();
+				generator.generate(chunk);
+				lock.lock();
+				chunk.state = Chunk::DONE;
+				changed.notify_all();
+			}
+		});
+	}
+
+	bool failed = false, capture_failed = false;
+	for (uint64_t written = 0;; written++) {
+		std::unique_lock<std::mutex> lock(mutex);
+
+		// plan ahead as far as there are free slots
+		while (!finished && planned - written < slots.size()) {
+			if (!generator.plan(slots[planned % slots.size()], labels))
+				finished = true;
+			else
+				planned++;
+			changed.notify_all();
+		}
+		if (written == planned)
+			break;
+
+		Chunk& chunk = slots[written % slots.size()];
+		changed.wait(lock, [&] { return chunk.state == Chunk::DONE; });
+		lock.unlock();
+
+		if (opts.format == FORMAT_CAPTURE) {
+			for (size_t i = 0; i < chunk.rows && !capture_failed; i++)
+				capture_failed = !capture.add(chunk.t[i], &chunk.values[i * opts.channels]);
+		} else {
+			out.put(chunk.text);
+			out.input_block_end();
+		}
+		if (labels_fd >= 0) {
+			labels_out.put(labels);
+			labels.clear();
+		}
+
+		lock.lock();
+		chunk.state = Chunk::EMPTY;
+		if (out.failed() || labels_out.failed() || capture_failed) {
+			failed = true;
+			finished = true;
+			planned = to_generate;   // stop workers, skip chunks not taken yet
+			changed.notify_all();
+			lock.unlock();
+			break;
+		}
+	}
+
+	for (std::thread& w : workers)
+		w.join();
+
+	if (capture_failed) {
+		std::cerr << capture.error() << " (--format capture stores int32 values)" << std::endl;
+		return 1;
+	}
+	if (failed) {
+		// consumer has gone (e.g. head), not an error of the generator
+		if (out.error() == EPIPE)
+			return 0;
+		std::cerr << "Output write error: " << strerror(out.failed() ? out.error() : labels_out.error()) << std::endl;
+		return 1;
+	}
+
+	if (opts.format == FORMAT_CAPTURE && !capture.finish()) {
+		std::cerr << capture.error() << std::endl;
+		return 1;
+	}
+	out.flush();
+	labels_out.flush();
+	if (out.failed() || labels_out.failed()) {
+		std::cerr << "Output write error: " << strerror(out.failed() ? out.error() : labels_out.error()) << std::endl;
+		return 1;
+	}
+	return 0;
+}
@@ -27,322 +27,1702 @@ isalarm - if alarm, 1 is printed, else 0
 iswait - if waiting status, 1 is printed (see WAIT_STATE_USEC), else 0
 patternid - if no pattern recognition status, prints 0 else prints sequential number of recognized pattern at each related line
 
+With --channels N, each input row holds N values (timestamp;value1;...;valueN)
+and only events are outputted, one line per event of a channel:
+
+lineid - current row
+timestamp - timestamp value
+channel - channel number (0..N-1)
+event - alarm (alarm raised and pattern started) or pattern_end (pattern ended)
+meas - measured value of the channel
+curavg - current average absolute value difference of the channel
+patternid - sequential number of the started or ended pattern of the channel
+
+As with --output events (see fp_events.h), a pattern_end row is that of the last
+row of the pattern (lineid, timestamp, meas and curavg).
+
+With --output events (one channel), only alarms, pattern ends and optional
+heartbeats are outputted instead of all samples, see fp_events.h.
+With --alarm-fd FD, alarm events are in addition written to FD immediately
+when detected, independently of the buffering of the output.
+
+With --patterns-out FILE, waveforms of all patterns including samples before
+their alarms are written to FILE, one record per pattern, see fp_patterns.h.
+
+With --convert-to FILE, input is only converted into a binary capture file
+(see fp_capture.h), which is then processed with --capture FILE instead of
+reading stdin; output is the same as for the text input.
+With --threads N, a one-channel capture is evaluated in segments on N threads
+with the same output, from detector states embedded into the capture by
+--embed-checkpoints or found speculatively (see fp_parallel.h).
+
+With --shm NAME, binary samples are taken from a shared-memory ring written by
+an acquisition process (see fp_shm.h, fp_shm_producer.cpp) instead of stdin;
+output is the same as for the text input.
+
+With --listen ADDRESS, the program is a server of many timestamp;value streams
+(connections, see fp_server.h) instead, each stream has its own detector and
+events of all streams are output as stream;event;lineid;... rows (see
+fp_events.h) until SIGINT or SIGTERM.
+
+With --calibrate FILE, the input (or a capture) is only scanned for its noise
+level and the resulting noise profile is written to FILE; a following run with
+--profile FILE starts with the calibrated INITIAL_AVG_DIFF (see fp_profile.h).
+
+With --checkpoint FILE, detector state and input/output positions are saved
+every --checkpoint-every samples; after a crash or restart, --resume continues
+from the last checkpoint with the same output as an uninterrupted run, e.g.:
+./fp_generate_patterns --checkpoint state.chk --resume < testdata.csv >> datalog.csv
+(see fp_checkpoint.h)
+
+Counters of processed lines, alarms and time spent in the stages are printed
+to stderr on SIGUSR1 or every --stats-interval seconds, see fp_stats.h.
+With --latency N, histograms of the delay between reading a sample and writing
+its output row are printed as well, see fp_histogram.h.
  */
 
 #include <iostream>
 #include <string>
 #include <iomanip>
-#include <sys/time.h>
+#include <charconv>
+#include <cstring>
+#include <cstdint>
+#include <vector>
+#include <algorithm>
+#include <thread>
+#include <mutex>
+#include <memory>
+#include <csignal>
+#include <pthread.h>
+#include <sched.h>
+#include <fcntl.h>
+#include <sys/stat.h>
+
+#include "fp_batch.h"
+#include "fp_capture.h"
+#include "fp_checkpoint.h"
+#include "fp_detector.h"
+#include "fp_events.h"
+#include "fp_histogram.h"
+#include "fp_multichannel.h"
+#include "fp_options.h"
+#include "fp_parallel.h"
+#include "fp_patterns.h"
+#include "fp_profile.h"
+#include "fp_reader.h"
+#include "fp_server.h"
+#include "fp_shm.h"
+#include "fp_spsc.h"
+#include "fp_stats.h"
+#include "fp_sweep.h"
+#include "fp_timestamp.h"
+#include "fp_writer.h"
+
+// Number of sample batches in flight in pipeline mode (power of two)
+#define PIPELINE_BATCHES 8
+
+////////////////////////////////////////////////////////////////////////////////////////
+// output section
+// to output in production, manage to output variable isalarm (and possibly iswait)
+////////////////////////////////////////////////////////////////////////////////////////
+
+// outputs one evaluated sample
+static void write_row(OutputWriter& out, long long lineid, std::string_view timestamp,
+		float meas, const AlarmNoiseRejectResult& r) {
+
+	// output "lineid;timestamp;meas;diff;diffavg;isdetect;isalarm;iswait;patternid"
+	out.put_int(lineid); out.put(';'); out.put(timestamp); out.put(';');
+	out.put_float(meas); out.put(';'); out.put_float(r.diff); out.put(';'); out.put_float(r.diffavg); out.put(';');
+	out.put_int(r.isdetect); out.put(';');
+	out.put_int(r.isalarm); out.put(';');
+	out.put_int(r.iswait); out.put(';'); out.put_int(r.patternid);
+	out.end_row(r.isalarm);
+}
 
-// Value of the initial absolute difference between subsequent points representing noise
-// The value should be set based on real average value
-// This value is used as the initial value for avgdiff variable
-#define INITIAL_AVG_DIFF 200
+// outputs header of one channel output
+static void write_header(OutputWriter& out, EventWriter* events) {
+	if (events)
+		events->header();
+	else {
+		out.put("lineid;timestamp;meas;diff;curavg;isdetect;isalarm;iswait;patternid");
+		out.end_row();
+	}
+}
 
-// How many subsequent points need to have greater difference between them
-// than avgdiff * MULTIPLICATOR_TO_DETECT to raise alarm
-#define NUMBER_OF_POINTS_TO_ALARM 5 // must be >= 1
+// outputs one evaluated sample (or its events only) and passes it to pattern extraction
+// timestamp() returns the timestamp text
+template <class TimestampText>
+static void write_sample(OutputWriter& out, EventWriter* events, PatternExtractor* patterns,
+		long long lineid, int64_t t_usec, float meas, const AlarmNoiseRejectResult& r, TimestampText timestamp) {
+	if (events)
+		events->add(lineid, t_usec, meas, r, timestamp);
+	else
+		write_row(out, lineid, timestamp(), meas, r);
+	if (patterns)
+		patterns->add(lineid, t_usec, meas, r, timestamp);
+}
 
-// How many microseconds must elapse between detected alarm to detect subsequent alarm
-// e.g. 5 secs = 5000000
-#define WAIT_STATE_USEC 1000000
+// passes output row of the sample read at read_ns to latency tracking (events output: alarm rows only)
+static void track_latency(LatencyTracker* latency, EventWriter* events, int64_t read_ns, const AlarmNoiseRejectResult& r) {
+	if (latency && (!events || r.isalarm))
+		latency->row(read_ns, r.isalarm);
+}
 
-// Multiplicator to multiplicate diffavg value to set the threshold for alarm detection
-#define MULTIPLICATOR_TO_DETECT 10
+// outputs evaluated samples of the batch
+static void write_batch(OutputWriter& out, EventWriter* events, PatternExtractor* patterns,
+		LatencyTracker* latency, const SampleBatch& batch) {
+	for (size_t i = 0; i < batch.n; i++) {
+		track_latency(latency, events, batch.read_ns, batch.r[i]);
+		write_sample(out, events, patterns, batch.first_lineid + i, batch.t[i], batch.v[i], batch.r[i],
+				[&] { return batch.timestamp(i); });
+	}
+}
 
-// Smoothing constant for subsequent diffavg amendments, must be >= 1
-// higher value means lower sensitivity to average diff value change
-#define N_AMEND_AVGDIFF 500
+// last evaluated row of the multichannel detector: pattern_end is dated at the last
+// sample of the pattern (as by EventWriter), which is the row before the one it is found at
+struct ChannelLastRow {
+	long long lineid = 0;
+	int64_t t_usec = 0;
+	std::string timestamp;   // text of the row, if kept
+	std::vector<float> meas, diffavg;
+
+	explicit ChannelLastRow(size_t channels) : meas(channels), diffavg(channels) {}
+
+	void set(long long row_lineid, int64_t row_t_usec, const MultiChannelDetector& detector) {
+		lineid = row_lineid;
+		t_usec = row_t_usec;
+		for (size_t ch = 0; ch < meas.size(); ch++) {
+			meas[ch] = detector.value(ch);
+			diffavg[ch] = detector.diffavg(ch);
+		}
+	}
+};
+
+// outputs event of a channel of the multichannel detector
+static void write_channel_event(OutputWriter& out, long long lineid, std::string_view timestamp,
+		size_t ch, bool alarm, float meas, float diffavg, int patternid) {
+
+	// output "lineid;timestamp;channel;event;meas;curavg;patternid"
+	out.put_int(lineid); out.put(';'); out.put(timestamp); out.put(';');
+	out.put_int(ch); out.put(';'); out.put(alarm ? "alarm" : "pattern_end"); out.put(';');
+	out.put_float(meas); out.put(';'); out.put_float(diffavg); out.put(';');
+	out.put_int(patternid);
+	out.end_row(alarm);
+}
 
-// Sampling parameter: uses each nth input value for evaluation
-// If SAMPLE_EACH == 1, takes every value (no sampling)
-#define SAMPLE_EACH 1
+// outputs events of all channels of the row evaluated last, timestamp is its text and
+// last_timestamp the text of the last row before it
+static void write_channel_events(OutputWriter& out, long long lineid, std::string_view timestamp,
+		const MultiChannelDetector& detector, const ChannelLastRow& last, std::string_view last_timestamp) {
+	for (size_t ch = 0; ch < detector.size(); ch++) {
+		int event = detector.event(ch);
+		// pattern ended before the new one started at the same row
+		if (event & CHANNEL_EVENT_PATTERN_END)
+			write_channel_event(out, last.lineid, last_timestamp, ch, false, last.meas[ch], last.diffavg[ch],
+					detector.patternid(ch) - (event & CHANNEL_EVENT_ALARM));
+		if (event & CHANNEL_EVENT_ALARM)
+			write_channel_event(out, lineid, timestamp, ch, true, detector.value(ch), detector.diffavg(ch),
+					detector.patternid(ch));
+		STATS_ADD(patterns, !!(event & CHANNEL_EVENT_PATTERN_END));
+		STATS_ADD(alarms, !!(event & CHANNEL_EVENT_ALARM));
+	}
+}
 
-// Max pattern length: how long pattern recognition can last in microseconds
-// If PATTERN_STATE_USEC == 100000, takes 0.1 sec pattern
-#define PATTERN_STATE_USEC 250000
+////////////////////////////////////////////////////////////////////////////////////////
+// end of output section
+////////////////////////////////////////////////////////////////////////////////////////
 
 
+// parses timestamp;value line, false (with a message) if the line is to be skipped,
+// fixed_point: the value is to be in the int32 range of the fixed-point detector
+static bool parse_sample(std::string_view line, TimestampDecoder& tsdecoder,
+		std::string_view& timestamp, int64_t& t_usec, double& value, bool fixed_point) {
 
+	// timestamp before ;, measured value after ;, both trimmed
+	std::string_view valuetext;
+	split_fields(line, timestamp, valuetext);
 
-// prototype
-std::string trim (const std::string&);
+	// parse measured value first, skip lines without a value (e.g. empty lines)
+	// trailing characters (e.g. \r) are ignored
+	if (std::from_chars(valuetext.data(), valuetext.data() + valuetext.size(), value).ec != std::errc()) {
+		if (!line.empty()) {
+			std::cerr << "Skipping input line without measured value: " << line << std::endl;
+			STATS_ADD(parse_failures, 1);
+		}
+		return false;
+	}
 
+	// the detector gets the value as float, nan and inf are parsed too
+	if (fixed_point && !fixed_point_value_valid(static_cast<float>(value))) {
+		std::cerr << "Skipping input line with value out of int32 range (--arithmetic fixed): " << line << std::endl;
+		STATS_ADD(parse_failures, 1);
+		return false;
+	}
 
-// structure for time storing
+	// parse timestamp, e.g. 10-03-2016 15:19:20.729915
+	if (!tsdecoder.decode(timestamp, t_usec)) {
+		std::cerr << "Skipping input line with invalid timestamp: " << line << std::endl;
+		STATS_ADD(parse_failures, 1);
+		return false;
+	}
+	return true;
+}
 
-int main(int argc, char* argv[]) {
+// starts immediate alarm notification if requested, nullptr if off
+static AlarmNotifier* start_alarm_notifier(const ProgramOptions& opts, AlarmNotifier& notifier) {
+	if (opts.alarm_fd < 0)
+		return nullptr;
+	notifier.header();
+	return &notifier;
+}
 
-	// variable for sampling
-	int sampling = SAMPLE_EACH;
-	float diffavg = INITIAL_AVG_DIFF;  // initial value of average noise difference
-	int number_of_points_to_alarm = NUMBER_OF_POINTS_TO_ALARM;
-	int wait_state_usec = WAIT_STATE_USEC;
-	int multiplicator_to_detect = MULTIPLICATOR_TO_DETECT;
-	int n_amend_avgdiff = N_AMEND_AVGDIFF;
-	int pattern_state_usec = PATTERN_STATE_USEC;
+// false (with a message) on alarm notification write error
+static bool alarm_notifier_ok(AlarmNotifier* alarms) {
+	if (alarms && alarms->failed()) {
+		std::cerr << "Alarm write error: " << strerror(alarms->error()) << std::endl;
+		return false;
+	}
+	return true;
+}
 
+// time (steady clock) the line just returned by reader entered the process
+static int64_t input_time_ns(const InputReader& reader) {
+	return reader.is_mapped() ? stats_now_ns() : reader.block_read_ns();
+}
 
-	// arguments evaluation
-	// program to be called with either none or all six integer arguments in the order:
+// turns on latency tracking of rows written by out if requested, nullptr if off
+static LatencyTracker* track_output_latency(const ProgramOptions& opts, LatencyTracker& tracker, OutputWriter& out) {
+	if (!opts.latency_every)
+		return nullptr;
+	program_stats.latency_every = opts.latency_every;
+	out.set_write_hook([&tracker] { tracker.emitted(); });
+	return &tracker;
+}
 
-	/* SAMPLE_EACH
-	 * INITIAL_AVG_DIFF
-	 * NUMBER_OF_POINTS_TO_ALARM
-	 * WAIT_STATE_USEC
-	 * MULTIPLICATOR_TO_DETECT
-	 * N_AMEND_AVGDIFF
-	 */
+// pins calling thread to cpu (if cpu >= 0)
+static void pin_thread(int cpu) {
+	if (cpu < 0)
+		return;
+	cpu_set_t set;
+	CPU_ZERO(&set);
+	CPU_SET(cpu, &set);
+	int err = pthread_setaffinity_np(pthread_self(), sizeof(set), &set);
+	if (err)
+		std::cerr << "Cannot pin thread to CPU " << cpu << ": " << strerror(err) << std::endl;
+}
 
 
-	// if at least one argument passed, evaluate number of them
-	if (argc > 1 and argc < 8) {
-		std::cerr << "Arguments error: must pass 7 integer arguments or none" << std::endl;
-		std::cerr << "Number of arguments passed: " << argc - 1 << std::endl;
-		std::cerr << "Program terminated" << std::endl;
-		return 1;
+// bytes in a regular output file before the first write (0 for other outputs)
+static uint64_t output_position(int fd) {
+	struct stat st;
+	if (fstat(fd, &st) < 0 || !S_ISREG(st.st_mode))
+		return 0;
+	if (fcntl(fd, F_GETFL) & O_APPEND)
+		return st.st_size;
+	off_t offset = lseek(fd, 0, SEEK_CUR);
+	return offset < 0 ? 0 : offset;
+}
+
+// continues from the checkpoint of opts.checkpoint_file: restores detector state and lineid,
+// skips consumed input and cuts regular output file to the checkpointed size
+// false on error, resumed is false if there is no checkpoint yet
+template <class Detector>
+static bool resume_checkpoint(const ProgramOptions& opts, Detector& detector, InputReader& reader,
+		long long& lineid, bool& resumed) {
+	resumed = false;
+	Checkpoint checkpoint;
+	if (!checkpoint.load(opts.checkpoint_file)) {
+		if (!checkpoint.missing()) {
+			std::cerr << checkpoint.error() << std::endl;
+			return false;
+		}
+		std::cerr << "No checkpoint " << opts.checkpoint_file << ", starting from the beginning" << std::endl;
+		return true;
+	}
+	if (!(checkpoint.data.params == detector.params())) {
+		std::cerr << "Checkpoint " << opts.checkpoint_file << " was taken with other parameters:" << std::endl;
+		checkpoint.data.params.print(std::cerr);
+		return false;
+	}
+	if (!reader.skip(checkpoint.data.input_offset)) {
+		std::cerr << "Input is shorter than the checkpointed position " << checkpoint.data.input_offset << std::endl;
+		return false;
 	}
 
-	// parse arguments
-	if (argc == 8) {
-		try {
-		sampling = atoi(argv[1]);
-		diffavg = atoi(argv[2]);
-		number_of_points_to_alarm = atoi(argv[3]);
-		wait_state_usec = atoi(argv[4]);
-		multiplicator_to_detect = atoi(argv[5]);
-		n_amend_avgdiff = atoi(argv[6]);
-		pattern_state_usec = atoi(argv[7]);
-		} catch (const std::exception &exc) {
-			std::cerr << "Arguments parsing error (must pass 7 integer arguments)";
-			std::cerr << exc.what() << std::endl;
-			return 1;
+	// output written after the checkpoint is replaced
+	struct stat st;
+	if (fstat(STDOUT_FILENO, &st) == 0 && S_ISREG(st.st_mode)) {
+		off_t size = checkpoint.data.output_offset;
+		if (st.st_size < size) {
+			std::cerr << "Output is shorter than the checkpointed size " << size << std::endl;
+			return false;
+		}
+		if (ftruncate(STDOUT_FILENO, size) < 0 || lseek(STDOUT_FILENO, size, SEEK_SET) < 0) {
+			std::cerr << "Cannot cut output to the checkpointed size: " << strerror(errno) << std::endl;
+			return false;
 		}
 	}
 
-	// verify (somehow) values of arguments
-	if (sampling < 1 ||
-		diffavg < 1 ||
-		number_of_points_to_alarm < 1 ||
-		wait_state_usec < 1 ||
-		multiplicator_to_detect < 1 ||
-		n_amend_avgdiff < 1 ||
-		pattern_state_usec < 1) {
-	std::cerr << std::endl << "Invalid argument(s) value(s):" << std::endl;
-	std::cerr << "=============================" << std::endl;
-	std::cerr << "sample_each: " << sampling << std::endl;
-	std::cerr << "initial_avg_diff: " << diffavg << std::endl;
-	std::cerr << "number_of_points_to_alarm: " << number_of_points_to_alarm << std::endl;
-	std::cerr << "wait_state_usec: " << wait_state_usec << std::endl;
-	std::cerr << "multiplicator_to_detect: " << multiplicator_to_detect << std::endl;
-	std::cerr << "n_amend_avgdiff: " << n_amend_avgdiff << std::endl;
-	std::cerr << "pattern_state_usec: " << pattern_state_usec << std::endl << std::endl;
-	std::cerr << "Exiting..." << std::endl << std::endl;
+	detector.set_state(checkpoint.data.state);
+	lineid = checkpoint.data.lineid;
+	resumed = true;
+	return true;
+}
 
-	// error exit
-	return 1;
-	}
 
+// processing of one channel, timestamp;value lines on stdin
+// detector with all alarm and pattern related state, see dispatch_detector()
+template <class Detector>
+static int run_single_channel(const ProgramOptions& opts, Detector detector) {
 
+	// variables for read data and parsing
+	// (slices of the input buffer, no copies are made)
+	InputReader reader(STDIN_FILENO);
+	std::string_view lineread, p1;
+	double parsedval;
 
-	// start processing //
+	// timestamps are converted to microseconds since epoch
+	TimestampDecoder tsdecoder(opts.utc_offset_sec);
+	int64_t curtime;
 
-	// init sample count
-	int cursample = sampling;
+	// variable to count number of input lines
+	long long lineid=0;
 
-	// variables for read data and parsing
-	std::string lineread, p1, p2;
-	int d,m,y,h,mi,s,ms;
+	// optional continuation of an interrupted run
+	bool resumed = false;
+	if (opts.resume && !resume_checkpoint(opts, detector, reader, lineid, resumed))
+		return 1;
+
+	// parsed samples are evaluated and written in batches
+	SampleBatch batch;
+
+	// buffered output, all samples or events only, optionally with latency tracking
+	LatencyTracker latency_tracker(program_stats.latency_rows, program_stats.latency_alarms, opts.latency_every);
+	OutputWriter out(STDOUT_FILENO, opts.flush_policy);
+	LatencyTracker* latency = track_output_latency(opts, latency_tracker, out);
+	EventWriter event_writer(out, opts.heartbeat_usec);
+	EventWriter* events = opts.events_output ? &event_writer : nullptr;
+
+	// optional immediate alarms
+	AlarmNotifier alarm_notifier(opts.alarm_fd);
+	AlarmNotifier* alarms = start_alarm_notifier(opts, alarm_notifier);
 
+	// optional pattern waveforms
+	PatternFile pattern_file;
+	if (opts.patterns_file && !pattern_file.open(opts.patterns_file, opts.patterns_binary, opts.pattern_pre, opts.pattern_post))
+		return 1;
+	PatternExtractor* patterns = pattern_file.extractor();
+
+	auto process_batch = [&] {
+		STATS_TIME_START(detect_start);
+		batch.detect(detector);
+		STATS_TIME_END(detect_start, detect_ns);
+		STATS_RESULTS(batch.t, batch.r, batch.n);
+		if (alarms)
+			alarms->add(batch.first_lineid, batch.v, batch.r, batch.n, [&](size_t i) { return batch.timestamp(i); });
+
+		STATS_TIME_START(write_start);
+		write_batch(out, events, patterns, latency, batch);
+		STATS_TIME_END(write_start, write_ns);
+		batch.clear();
+	};
+
+	// optional checkpoints, taken when all samples read so far are processed
+	// (after a full batch or before a refill, reader is at the end of the last line taken)
+	// output is flushed first, so the checkpoint never refers to unwritten output
+	// none after an incomplete last line, it is read again in full by the resumed run
+	Checkpoint checkpoint;
+	long long checkpoint_lineid = lineid;
+	bool checkpoint_failed = false;
+	uint64_t output_base = opts.checkpoint_file ? output_position(STDOUT_FILENO) : 0;
+	auto save_checkpoint = [&] {
+		if (!reader.line_terminated())
+			return;
+		out.flush();
+		if (out.failed())
+			return;   // reported at the end
+		checkpoint.data.params = detector.params();
+		checkpoint.data.state = detector.state();
+		checkpoint.data.lineid = lineid;
+		checkpoint.data.input_offset = reader.offset();
+		checkpoint.data.output_offset = output_base + out.written();
+		checkpoint_lineid = lineid;
+		if (!checkpoint.save(opts.checkpoint_file)) {
+			std::cerr << checkpoint.error() << std::endl;
+			checkpoint_failed = true;
+		}
+	};
+	auto checkpoint_if_due = [&] {
+		if (opts.checkpoint_file && lineid - checkpoint_lineid >= opts.checkpoint_every)
+			save_checkpoint();
+	};
+
+	// before the reader waits for more input, process what has been read so far
+	reader.set_refill_hook([&] {
+		process_batch();
+		STATS_TIME_START(write_start);
+		out.input_block_end();
+		STATS_TIME_END(write_start, write_ns);
+		checkpoint_if_due();
+	});
+
+	// output header (already written by the resumed run)
+	if (!resumed)
+		write_header(out, events);
+
+	while (!checkpoint_failed && reader.next_line(lineread))	{
+		STATS_ADD(lines, 1);
 
-	// helper variable for string char conversion
-	char* c;
-	c = new char[100];
+		// debug output: copy of input line
+		// std::cout << std::endl << lineread << std::endl;
 
-	// variables related to alarm
-	short isalarm = 0;
-	short iswait = 0;
-	int numthresholded = number_of_points_to_alarm;
 
-	// variables for alarm delay calculation
-	struct timeval lasttime = {2147483646,0}; // large enough
-	struct timeval curtime = lasttime;
-	struct timeval alarmraisetime = {0,0};    // small enough
-	struct timeval patternraisetime = {0,0};    // small enough
+		// sampling?
+		if (!detector.sample()) {
 
-	// helper tm structure for conversion
-	struct tm t = {0};  // Initalize to all 0's
+			// debug
+			// std::cout << "previous line sampled out" << std::endl;
+			STATS_ADD(sampled_out, 1);
+			continue;
+		}
 
-	// helper position variable
-	int pos;
+		// parses input line
+		if (!parse_sample(lineread, tsdecoder, p1, curtime, parsedval, detector.params().fixed_point))
+			continue;
 
-	// variable to count number of input lines
-	long long lineid=0;
+		// increments lineid and adds sample to the batch
+		if (latency && !batch.n)
+			batch.read_ns = input_time_ns(reader);
+		batch.add(++lineid, p1, curtime, parsedval);
 
-	// values for calculations (mind type)
-	float curval,lastval; // current and last value
-	float diff = 0; // difference from previous value, absolute value
-	float diffnoabs = 0; // noabsvalue
+		// alarm_noisereject evaluation and output
+		if (batch.full()) {
+			process_batch();
+			checkpoint_if_due();
+		}
+	}
+	if (checkpoint_failed)
+		return 1;
+
+	process_batch();
+	if (!pattern_file.close() || !alarm_notifier_ok(alarms))
+		return 1;
+
+	if (reader.failed()) {
+		std::cerr << "Input read error: " << strerror(reader.error()) << std::endl;
+		return 1;
+	}
+
+	if (opts.checkpoint_file)
+		save_checkpoint();
+	if (checkpoint_failed)
+		return 1;
+
+	out.flush();
+	if (out.failed()) {
+		std::cerr << "Output write error: " << strerror(out.error()) << std::endl;
+		return 1;
+	}
 
-	// patterns related variables
-	int patternid = 0 ;
-	short ispattern = 0; // status variable for pattern tracking
+	return 0;
+}
+
+
+// processing of one channel in three threads:
+// read+parse (calling thread) -> detect -> format+write
+// stages pass batches of samples through single-producer/single-consumer rings
+template <class Detector>
+static int run_single_channel_pipeline(const ProgramOptions& opts, Detector detector) {
+
+	// pool of batches circulating between the stages
+	std::vector<SampleBatch> pool(PIPELINE_BATCHES);
+	SpscRing<SampleBatch*, PIPELINE_BATCHES> free_batches, parsed, detected;
+	for (SampleBatch& b : pool)
+		free_batches.push(&b);
+
+	// cpu of each stage, -1 if not pinned
+	int cpus[3] = { -1, -1, -1 };
+	for (size_t i = 0; i < 3 && i < opts.pin_cpus.size(); i++)
+		cpus[i] = opts.pin_cpus[i];
+
+	// buffered output, used by the output stage only once it runs
+	LatencyTracker latency_tracker(program_stats.latency_rows, program_stats.latency_alarms, opts.latency_every);
+	OutputWriter out(STDOUT_FILENO, opts.flush_policy);
+	LatencyTracker* latency = track_output_latency(opts, latency_tracker, out);
+	EventWriter event_writer(out, opts.heartbeat_usec);
+	EventWriter* events = opts.events_output ? &event_writer : nullptr;
+
+	// optional immediate alarms, written by the detection stage
+	AlarmNotifier alarm_notifier(opts.alarm_fd);
+	AlarmNotifier* alarms = start_alarm_notifier(opts, alarm_notifier);
+
+	// optional pattern waveforms, written by the output stage too
+	PatternFile pattern_file;
+	if (opts.patterns_file && !pattern_file.open(opts.patterns_file, opts.patterns_binary, opts.pattern_pre, opts.pattern_post))
+		return 1;
+	PatternExtractor* patterns = pattern_file.extractor();
 
 	// output header
-	std::cout << "lineid;timestamp;meas;diff;curavg;isdetect;isalarm;iswait;patternid" << std::endl ;
+	write_header(out, events);
+	program_stats.stage_timing = STAGES_PIPELINED;
+
+	// detection stage, nullptr ends the stream
+	std::thread detect_thread([&] {
+		pin_thread(cpus[1]);
+		for (;;) {
+			SampleBatch* b = parsed.pop();
+			if (b) {
+				STATS_TIME_START(detect_start);
+				b->detect(detector);
+				STATS_TIME_END(detect_start, detect_ns);
+				STATS_RESULTS(b->t, b->r, b->n);
+				if (alarms)
+					alarms->add(b->first_lineid, b->v, b->r, b->n, [&](size_t i) { return b->timestamp(i); });
+			}
+			detected.push(b);
+			if (!b)
+				break;
+		}
+	});
+
+	// output stage
+	std::thread output_thread([&] {
+		pin_thread(cpus[2]);
+		for (;;) {
+			SampleBatch* b = detected.pop();
+			if (!b)
+				break;
+			STATS_TIME_START(write_start);
+			write_batch(out, events, patterns, latency, *b);
+			if (b->input_block_end)
+				out.input_block_end();
+			STATS_TIME_END(write_start, write_ns);
+			b->clear();
+			free_batches.push(b);
+		}
+		out.flush();
+	});
 
-	while (std::getline(std::cin,lineread))	{
+	// read and parse stage
+	pin_thread(cpus[0]);
 
-		// debug output: copy of input line
-		// std::cout << std::endl << lineread << std::endl;
+	InputReader reader(STDIN_FILENO);
+	std::string_view lineread, p1;
+	double parsedval;
+	TimestampDecoder tsdecoder(opts.utc_offset_sec);
+	int64_t curtime;
+	long long lineid = 0;
+
+	// sampling is done here, before parsing
+	const AlarmNoiseRejectParams& params = detector.params();
+	int cursample = params.sample_each;
+
+	SampleBatch* batch = free_batches.pop();
+
+	// before the reader waits for more input, pass on what has been read so far
+	reader.set_refill_hook([&] {
+		batch->input_block_end = true;
+		parsed.push(batch);
+		batch = free_batches.pop();
+	});
 
+	while (reader.next_line(lineread)) {
+		STATS_ADD(lines, 1);
 
 		// sampling?
 		if (cursample-- > 1) {
+			STATS_ADD(sampled_out, 1);
+			continue;
+		}
+		cursample = params.sample_each;
 
-			// debug
-			// std::cout << "previous line sampled out" << std::endl;
+		if (!parse_sample(lineread, tsdecoder, p1, curtime, parsedval, params.fixed_point))
 			continue;
+
+		if (latency && !batch->n)
+			batch->read_ns = input_time_ns(reader);
+		batch->add(++lineid, p1, curtime, parsedval);
+		if (batch->full()) {
+			parsed.push(batch);
+			batch = free_batches.pop();
 		}
-		else
-			cursample = sampling;
+	}
 
-		// parses input line
-		pos = lineread.find(';');
-		p1 = trim(lineread.substr(0,pos));  // parse and trim first before ;, i.e. timestamp
-		p2 = trim(lineread.erase(0,pos + 1)); // parse and trim measured value
+	// last batch and end of stream
+	parsed.push(batch);
+	parsed.push(nullptr);
+
+	detect_thread.join();
+	output_thread.join();
+	if (!pattern_file.close() || !alarm_notifier_ok(alarms))
+		return 1;
 
-		// convert string to char to be used by sscanf
-		std::copy(p1.begin(), p1.end(), c);
-		c[p1.size()] = '\0'; // terminating 0
+	if (reader.failed()) {
+		std::cerr << "Input read error: " << strerror(reader.error()) << std::endl;
+		return 1;
+	}
 
-		// parse using sscanf
-		// 10-03-2016 15:19:20.729915
-		sscanf(c,"%d-%d-%d %d:%d:%d.%d", &d, &m, &y, &h, &mi, &s, &ms);
+	if (out.failed()) {
+		std::cerr << "Output write error: " << strerror(out.error()) << std::endl;
+		return 1;
+	}
 
-		// fill current time
-		t.tm_year = y-1900;t.tm_mon = m;t.tm_mday = d;t.tm_hour = h;t.tm_min = mi;t.tm_sec = s;
-		curtime.tv_sec = mktime(&t); curtime.tv_usec=ms;
+	return 0;
+}
 
-		lasttime = curtime;
 
-		// take current value to curval
-		curval = std::stod(p2);
+// processing of one channel of binary samples from shared-memory ring
+template <class Detector>
+static int run_shm(const ProgramOptions& opts, Detector detector) {
 
-		// increments lineid and copies last values for the first line
-		if (!lineid++) lastval = curval;
+	ShmRingConsumer ring;
+	if (!ring.attach(opts.shm_name, opts.shm_wait)) {
+		std::cerr << ring.error() << std::endl;
+		return 1;
+	}
 
+	// buffered output, all samples or events only, optionally with latency tracking
+	LatencyTracker latency_tracker(program_stats.latency_rows, program_stats.latency_alarms, opts.latency_every);
+	OutputWriter out(STDOUT_FILENO, opts.flush_policy);
+	LatencyTracker* latency = track_output_latency(opts, latency_tracker, out);
+	EventWriter event_writer(out, opts.heartbeat_usec);
+	EventWriter* events = opts.events_output ? &event_writer : nullptr;
 
-		// calculate diff as abs value
-		diffnoabs = curval - lastval;
-		diff = abs(diffnoabs);
+	AlarmNotifier alarm_notifier(opts.alarm_fd);
+	AlarmNotifier* alarms = start_alarm_notifier(opts, alarm_notifier);
 
-		// pattern evaluation
-		if (ispattern == 1) {
-			// is in "pattern" state
+	PatternFile pattern_file;
+	if (opts.patterns_file && !pattern_file.open(opts.patterns_file, opts.patterns_binary, opts.pattern_pre, opts.pattern_post))
+		return 1;
+	PatternExtractor* patterns = pattern_file.extractor();
+
+	write_header(out, events);
+
+	// samples taken from the ring at once, sampled ones are evaluated
+	std::vector<ShmSample> samples(SAMPLE_BATCH_SIZE);
+	std::vector<int64_t> t(SAMPLE_BATCH_SIZE);
+	std::vector<float> v(SAMPLE_BATCH_SIZE);
+	std::vector<AlarmNoiseRejectResult> r(SAMPLE_BATCH_SIZE);
+	char tsbuf[TIMESTAMP_TEXT_LEN];
+	std::string_view p1(tsbuf, TIMESTAMP_TEXT_LEN);
+	long long lineid = 0;
+
+	// samples out of the int32 range of the fixed-point detector are skipped
+	bool fixed = detector.params().fixed_point;
+
+	for (;;) {
+		size_t count = ring.read(samples.data(), SAMPLE_BATCH_SIZE);
+		if (!count) {
+			// before waiting for more samples, output what has been processed
+			out.input_block_end();
+			if (!ring.wait())
+				break;
+			continue;
+		}
+		int64_t read_ns = latency ? stats_now_ns() : 0;
+		STATS_ADD(lines, count);
+
+		size_t n = 0;
+		for (size_t i = 0; i < count; i++) {
+			if (!detector.sample()) {
+				STATS_ADD(sampled_out, 1);
+				continue;
+			}
+			if (fixed && !fixed_point_value_valid(samples[i].value)) {
+				std::cerr << "Skipping sample with value out of int32 range (--arithmetic fixed): " << samples[i].value << std::endl;
+				STATS_ADD(parse_failures, 1);
+				continue;
+			}
+			t[n] = samples[i].t_usec;
+			v[n] = samples[i].value;
+			n++;
+		}
 
-			// debug
-			// std::cout << "pattern recognition" << std::endl;
-			// std::cout << "patterndiff: " << (curtime.tv_sec - patternraisetime.tv_sec) * 1000000 + (curtime.tv_usec - patternraisetime.tv_usec) << std::endl;
+		STATS_TIME_START(detect_start);
+		detector.process(t.data(), v.data(), n, r.data());
+		STATS_TIME_END(detect_start, detect_ns);
+		STATS_RESULTS(t.data(), r.data(), n);
+
+		// timestamp is formatted only when output
+		auto timestamp = [&](size_t i) {
+			format_timestamp(t[i], opts.utc_offset_sec, tsbuf);
+			return p1;
+		};
+		if (alarms)
+			alarms->add(lineid + 1, v.data(), r.data(), n, timestamp);
+
+		STATS_TIME_START(write_start);
+		for (size_t k = 0; k < n; k++) {
+			track_latency(latency, events, read_ns, r[k]);
+			write_sample(out, events, patterns, ++lineid, t[k], v[k], r[k], [&] { return timestamp(k); });
+		}
+		STATS_TIME_END(write_start, write_ns);
+	}
+
+	if (!pattern_file.close() || !alarm_notifier_ok(alarms))
+		return 1;
+
+	out.flush();
+	if (out.failed()) {
+		std::cerr << "Output write error: " << strerror(out.error()) << std::endl;
+		return 1;
+	}
+
+	return 0;
+}
+
+
+// one stream of the server, timestamp;value lines with its own detector
+// events are written to the output shared by all streams
+template <class Detector>
+class ServerSession : public StreamSession {
+public:
+	ServerSession(long long id, const std::string& peer, const ProgramOptions& opts, const Detector& detector,
+			OutputWriter& out, std::mutex& out_lock)
+		: id(id), detector(detector), tsdecoder(opts.utc_offset_sec),
+		  out(out), out_lock(out_lock), events(out, opts.heartbeat_usec) {
+		events.set_prefix(std::to_string(id) + ";");
+		std::cerr << "Stream " << id << " connected from " << peer << std::endl;
+	}
+
+	void input(std::string_view lines) override {
+		// batches are reused by all streams of the thread
+		static thread_local SampleBatch batch;
+
+		std::string_view timestamp;
+		int64_t t_usec;
+		double value;
+		while (!lines.empty()) {
+			size_t eol = lines.find('\n');
+			std::string_view line = lines.substr(0, eol);
+			lines.remove_prefix(eol == std::string_view::npos ? lines.size() : eol + 1);
+
+			if (!detector.sample())
+				continue;
+			if (!parse_sample(line, tsdecoder, timestamp, t_usec, value, detector.params().fixed_point))
+				continue;
+			batch.add(++lineid, timestamp, t_usec, value);
+			if (batch.full())
+				process(batch);
+		}
+		process(batch);
+
+		std::lock_guard<std::mutex> lock(out_lock);
+		out.input_block_end();
+	}
 
-			if (((curtime.tv_sec - patternraisetime.tv_sec) * 1000000) + (curtime.tv_usec - patternraisetime.tv_usec) > pattern_state_usec )
-							ispattern = 0; // reset pattern period
+	void end() override {
+		std::cerr << "Stream " << id << " closed after " << lineid << " samples" << std::endl;
+	}
 
+private:
+	void process(SampleBatch& batch) {
+		batch.detect(detector);
+		{
+			std::lock_guard<std::mutex> lock(out_lock);
+			for (size_t i = 0; i < batch.n; i++)
+				events.add(batch.first_lineid + i, batch.t[i], batch.v[i], batch.r[i], [&] { return batch.timestamp(i); });
 		}
+		batch.clear();
+	}
 
+	long long id;
+	long long lineid = 0;
+	Detector detector;
+	TimestampDecoder tsdecoder;
+	OutputWriter& out;
+	std::mutex& out_lock;
+	EventWriter events;
+};
+
+// server being run, stopped by signals
+static StreamServer* running_server;
+
+static void stop_server(int) {
+	if (running_server)
+		running_server->stop();
+}
 
-		//verify if waiting period after previously detected alarm
-		if (iswait == 1 ) {
+// server of many timestamp;value streams, events of all of them on stdout
+// detector (initial state) is copied into each stream
+template <class Detector>
+static int run_server(const ProgramOptions& opts, const Detector& detector) {
 
-			// is in "wait" state
+	// shared output of event rows of all streams
+	OutputWriter out(STDOUT_FILENO, opts.flush_policy);
+	std::mutex out_lock;
 
-			// after entering the wait state, reset the alarm status
-			// may change this behavior if needed
-			isalarm = 0;
+	StreamServer server([&](long long id, const std::string& peer) {
+		return std::unique_ptr<StreamSession>(new ServerSession<Detector>(id, peer, opts, detector, out, out_lock));
+	});
+	if (!server.listen(opts.listen_address)) {
+		std::cerr << server.error() << std::endl;
+		return 1;
+	}
 
-			// debug
-			// std::cout << "alarmdiff: " << (curtime.tv_sec - alarmraisetime.tv_sec) * 1000000 + (curtime.tv_usec - alarmraisetime.tv_usec) << std::endl;
+	// output header
+	out.put("stream;");
+	EventWriter(out).header();
+	out.flush();
+
+	running_server = &server;
+	struct sigaction sa;
+	memset(&sa, 0, sizeof(sa));
+	sa.sa_handler = stop_server;
+	sigaction(SIGINT, &sa, nullptr);
+	sigaction(SIGTERM, &sa, nullptr);
+
+	bool ok = server.run(opts.server_threads);
+	running_server = nullptr;
+	if (!ok) {
+		std::cerr << server.error() << std::endl;
+		return 1;
+	}
+
+	out.flush();
+	if (out.failed()) {
+		std::cerr << "Output write error: " << strerror(out.error()) << std::endl;
+		return 1;
+	}
+
+	return 0;
+}
+
+
+// processing of many channels, timestamp;value1;...;valueN lines or binary frames on stdin
+static int run_multichannel(const ProgramOptions& opts, const AlarmNoiseRejectParams& params) {
+
+	size_t channels = opts.channels;
+
+	// variables for read data and parsing
+	InputReader reader(STDIN_FILENO);
+	std::string_view lineread, p1, p2;
+	const char* record = nullptr;
+	size_t record_size = sizeof(int64_t) + channels * sizeof(float);
+	std::vector<float> row(channels);
+
+	// timestamps are converted to microseconds since epoch (and back for binary frames)
+	TimestampDecoder tsdecoder(opts.utc_offset_sec);
+	int64_t curtime;
+	char tsbuf[TIMESTAMP_TEXT_LEN];
+
+	// sampling is done for whole rows
+	int cursample = params.sample_each;
+
+	// variable to count number of input rows
+	long long lineid=0;
+
+	// detector of all channels
+	MultiChannelDetector detector(channels, params);
+	ChannelLastRow last(channels);
+	program_stats.stage_timing = STAGES_READ_ONLY;
 
-			if (((curtime.tv_sec - alarmraisetime.tv_sec) * 1000000) + (curtime.tv_usec - alarmraisetime.tv_usec) > wait_state_usec )
-				iswait = 0; // reset wait period
+	// buffered output
+	OutputWriter out(STDOUT_FILENO, opts.flush_policy);
+	reader.set_refill_hook([&out] { out.input_block_end(); });
+
+	// output header
+	out.put("lineid;timestamp;channel;event;meas;curavg;patternid");
+	out.end_row();
 
+	for (;;) {
+		if (opts.binary_frames) {
+			if (!reader.next_record(record_size, record))
+				break;
+		} else if (!reader.next_line(lineread))
+			break;
+		STATS_ADD(lines, 1);
+
+		// sampling?
+		if (cursample-- > 1) {
+			STATS_ADD(sampled_out, 1);
+			continue;
+		}
+		cursample = params.sample_each;
+
+		if (opts.binary_frames) {
+			memcpy(&curtime, record, sizeof(int64_t));
+			memcpy(row.data(), record + sizeof(int64_t), channels * sizeof(float));
+			format_timestamp(curtime, opts.utc_offset_sec, tsbuf);
+			p1 = std::string_view(tsbuf, TIMESTAMP_TEXT_LEN);
 		} else {
+			// timestamp before first ;, values after it
+			split_fields(lineread, p1, p2);
+			if (!parse_values(p2, row.data(), channels)) {
+				if (!lineread.empty()) {
+					std::cerr << "Skipping input line without " << channels << " measured values: " << lineread << std::endl;
+					STATS_ADD(parse_failures, 1);
+				}
+				continue;
+			}
+			if (!tsdecoder.decode(p1, curtime)) {
+				std::cerr << "Skipping input line with invalid timestamp: " << lineread << std::endl;
+				STATS_ADD(parse_failures, 1);
+				continue;
+			}
+		}
 
-			// not in wait state
+		lineid++;
+		STATS_ADD(samples, 1);
+		STATS_SET(last_sample_usec, curtime);
 
-			if (diff < multiplicator_to_detect * diffavg)
-				numthresholded = number_of_points_to_alarm; //reset thresholding count
-			else {
+		// alarm_noisereject evaluation of all channels, output of events
+		if (detector.push(curtime, row.data()))
+			write_channel_events(out, lineid, p1, detector, last, last.timestamp);
+		last.set(lineid, curtime, detector);
+		last.timestamp.assign(p1.data(), p1.size());
+	}
+
+	if (reader.failed()) {
+		std::cerr << "Input read error: " << strerror(reader.error()) << std::endl;
+		return 1;
+	}
+
+	out.flush();
+	if (out.failed()) {
+		std::cerr << "Output write error: " << strerror(out.error()) << std::endl;
+		return 1;
+	}
+
+	return 0;
+}
+
+
+// records detector states every opts.checkpoint_every rows of one channel capture
+// and embeds them into the capture file (replaces previous ones)
+static int embed_checkpoints(const char* filename, const ProgramOptions& opts, const AlarmNoiseRejectParams& params) {
+
+	CaptureCheckpoints checkpoints;
+	{
+		CaptureFile capture;
+		if (!capture.open(filename)) {
+			std::cerr << capture.error() << std::endl;
+			return 1;
+		}
+		if (capture.channels() != 1) {
+			std::cerr << "Arguments error: --embed-checkpoints is supported for one channel captures only" << std::endl;
+			return 1;
+		}
+		checkpoints = dispatch_detector(params, [&](auto detector) {
+			return record_checkpoints(capture, detector, opts.checkpoint_every);
+		});
+	}
+
+	CaptureWriter writer;
+	if (!writer.embed(filename, checkpoints.serialize())) {
+		std::cerr << writer.error() << std::endl;
+		return 1;
+	}
+	return 0;
+}
 
-				// debug
-				// std::cout << "numthresholded: " << numthresholded << std::endl;
 
-				// if number of subsequent points is enough, raise alarm
-				if (--numthresholded == 0) {
-					//	number of subsequent differences found
+// conversion of timestamp;value1;...;valueN lines on stdin into capture file
+// (with embedded detector states for params with --embed-checkpoints)
+static int run_convert(const ProgramOptions& opts, const AlarmNoiseRejectParams& params) {
 
-					// alarm raised
-					isalarm = 1;
-					alarmraisetime = curtime;
-					iswait = 1;
-					numthresholded = number_of_points_to_alarm;
+	size_t channels = opts.channels;
 
-					// pattern starts
-					patternid++;
-					ispattern = 1;
-					patternraisetime = curtime;
+	CaptureWriter capture;
+	if (!capture.create(opts.convert_file, channels, opts.capture_value_type, opts.utc_offset_sec)) {
+		std::cerr << capture.error() << std::endl;
+		return 1;
+	}
+
+	InputReader reader(STDIN_FILENO);
+	std::string_view lineread, p1, p2;
+	TimestampDecoder tsdecoder(opts.utc_offset_sec);
+	int64_t curtime;
+	std::vector<double> row(channels);
+
+	while (reader.next_line(lineread)) {
+		split_fields(lineread, p1, p2);
+		if (!parse_values(p2, row.data(), channels)) {
+			if (!lineread.empty())
+				std::cerr << "Skipping input line without " << channels << " measured values: " << lineread << std::endl;
+			continue;
+		}
+		if (!tsdecoder.decode(p1, curtime)) {
+			std::cerr << "Skipping input line with invalid timestamp: " << lineread << std::endl;
+			continue;
+		}
+
+		// int32 columns take whole numbers only
+		if (opts.capture_value_type == CAPTURE_INT32) {
+			for (double v : row) {
+				if (!capture_int32_value(v)) {
+					std::cerr << "Value is not a 32-bit integer (use --value-type float32): " << lineread << std::endl;
+					return 1;
 				}
 			}
 		}
 
-		// amend diffavg, use N_AMEND_AVGDIFF
+		if (!capture.add(curtime, row.data())) {
+			std::cerr << capture.error() << std::endl;
+			return 1;
+		}
+	}
 
-		// do not amend if in wait state of detection sequence based on number_of_points_to_alarm
-		if (iswait == 0 && numthresholded == number_of_points_to_alarm)
-			diffavg = (diffavg * (n_amend_avgdiff - 1) + diff) / n_amend_avgdiff;
+	if (reader.failed()) {
+		std::cerr << "Input read error: " << strerror(reader.error()) << std::endl;
+		return 1;
+	}
 
-		// if < 1, set 1
-		// if (diffavg < 1)
-		//	diffavg = 1;
+	if (!capture.finish()) {
+		std::cerr << capture.error() << std::endl;
+		return 1;
+	}
 
-		// remember current value,
-		lastval = curval;
+	if (opts.embed_checkpoints)
+		return embed_checkpoints(opts.convert_file, opts, params);
+	return 0;
+}
 
 
-		////////////////////////////////////////////////////////////////////////////////////////
-		// output section
-		// to output in production, manage to output variable isalarm (and possibly iswait)
-		////////////////////////////////////////////////////////////////////////////////////////
+// calibration, computes noise profile of stdin (timestamp;value lines) or of a channel of
+// the capture and writes it to opts.calibrate_file
+static int run_calibrate(const ProgramOptions& opts, const AlarmNoiseRejectParams& params) {
 
-		// output "lineid;timestamp;meas;diff;diffavg;isalarm;iswait"
-		std::cout << lineid << ';' << p1 << ";";
-		std::cout << curval << ";" << diffnoabs << ";" << diffavg << ";";
-		std::cout << (numthresholded == number_of_points_to_alarm ? 0 : 1) << ";";
-		std::cout << isalarm << ";";
-		std::cout << iswait << ";" << (ispattern ? patternid : 0) << std::endl;
+	NoiseCalibrator calibrator(params);
+	uint64_t limit = opts.calibrate_samples ? opts.calibrate_samples : UINT64_MAX;
 
-		////////////////////////////////////////////////////////////////////////////////////////
-		// end of output section
-		////////////////////////////////////////////////////////////////////////////////////////
+	// sampling as by the detector
+	AlarmNoiseRejectDetector sampler(params);
 
+	if (opts.capture_file) {
+		CaptureFile capture;
+		if (!capture.open(opts.capture_file)) {
+			std::cerr << capture.error() << std::endl;
+			return 1;
+		}
+		if (opts.calibrate_channel >= capture.channels()) {
+			std::cerr << "Capture " << opts.capture_file << " has no channel " << opts.calibrate_channel << std::endl;
+			return 1;
+		}
+		const int64_t* t = capture.timestamps();
+		for (uint64_t i = 0; i < capture.size() && calibrator.size() < limit; i++) {
+			if (!sampler.sample())
+				continue;
+			float v = capture.value(opts.calibrate_channel, i);
+			calibrator.add(t + i, &v, 1);
+		}
+	} else {
+		InputReader reader(STDIN_FILENO);
+		std::string_view lineread, p1;
+		TimestampDecoder tsdecoder(opts.utc_offset_sec);
+		int64_t curtime;
+		double parsedval;
+
+		while (calibrator.size() < limit && reader.next_line(lineread)) {
+			if (!sampler.sample())
+				continue;
+			if (!parse_sample(lineread, tsdecoder, p1, curtime, parsedval, false))
+				continue;
+			float v = parsedval;
+			calibrator.add(&curtime, &v, 1);
+		}
+		if (reader.failed()) {
+			std::cerr << "Input read error: " << strerror(reader.error()) << std::endl;
+			return 1;
+		}
 	}
 
+	if (calibrator.size() < 2) {
+		std::cerr << "Not enough samples to calibrate" << std::endl;
+		return 1;
+	}
+	NoiseProfile profile = calibrator.profile();
+	if (!profile.save(opts.calibrate_file)) {
+		std::cerr << profile.error() << std::endl;
+		return 1;
+	}
 	return 0;
 }
 
-std::string trim(const std::string& str)
-{
-	size_t first = str.find_first_not_of(' ');
-	if (std::string::npos == first)
-	{
-		return str;
+
+// evaluation and output of one channel capture
+template <class Detector>
+static void process_capture_channel(const CaptureFile& capture, OutputWriter& out,
+		EventWriter* events, PatternExtractor* patterns, LatencyTracker* latency, AlarmNotifier* alarms,
+		Detector& detector) {
+
+	uint64_t size = capture.size();
+	const int64_t* t = capture.timestamps();
+	long utc_offset_sec = capture.header().utc_offset_sec;
+	char tsbuf[TIMESTAMP_TEXT_LEN];
+	std::string_view p1(tsbuf, TIMESTAMP_TEXT_LEN);
+
+	long long lineid = 0;
+
+	// sampled (or converted int32) samples are gathered here
+	std::vector<int64_t> tbuf(SAMPLE_BATCH_SIZE);
+	std::vector<float> vbuf(SAMPLE_BATCH_SIZE);
+	std::vector<int32_t> ibuf(SAMPLE_BATCH_SIZE);
+	std::vector<AlarmNoiseRejectResult> r(SAMPLE_BATCH_SIZE);
+
+	// int32 columns go to the fixed-point detector as they are (float is exact up to 2^24 only)
+	bool int_values = detector.params().fixed_point && !capture.is_float();
+
+	uint64_t i = 0;
+	while (i < size) {
+		// mapped samples are taken as read when their batch starts
+		int64_t read_ns = latency ? stats_now_ns() : 0;
+		const int64_t* tp = tbuf.data();
+		const float* vp = vbuf.data();
+		const int32_t* ip = ibuf.data();
+		size_t n = 0;
+
+		if (detector.params().sample_each == 1) {
+			// all samples, float columns without copying
+			n = size - i < SAMPLE_BATCH_SIZE ? size - i : SAMPLE_BATCH_SIZE;
+			STATS_ADD(lines, n);
+			tp = t + i;
+			if (capture.is_float())
+				vp = capture.float_column(0) + i;
+			else {
+				capture.values(0, i, n, vbuf.data());
+				ip = capture.int_column(0) + i;
+			}
+			i += n;
+		} else {
+			for (; n < SAMPLE_BATCH_SIZE && i < size; i++) {
+				STATS_ADD(lines, 1);
+				if (!detector.sample()) {
+					STATS_ADD(sampled_out, 1);
+					continue;
+				}
+				tbuf[n] = t[i];
+				vbuf[n] = capture.value(0, i);
+				if (int_values)
+					ibuf[n] = capture.int_column(0)[i];
+				n++;
+			}
+		}
+
+		STATS_TIME_START(detect_start);
+		if (int_values)
+			detector.process(tp, ip, n, r.data());
+		else
+			detector.process(tp, vp, n, r.data());
+		STATS_TIME_END(detect_start, detect_ns);
+		STATS_RESULTS(tp, r.data(), n);
+		if (alarms) {
+			alarms->add(lineid + 1, vp, r.data(), n, [&](size_t k) {
+				format_timestamp(tp[k], utc_offset_sec, tsbuf);
+				return p1;
+			});
+		}
+
+		STATS_TIME_START(write_start);
+		for (size_t k = 0; k < n; k++) {
+			// timestamp is formatted only when output
+			auto timestamp = [&] {
+				format_timestamp(tp[k], utc_offset_sec, tsbuf);
+				return p1;
+			};
+			track_latency(latency, events, read_ns, r[k]);
+			write_sample(out, events, patterns, ++lineid, tp[k], vp[k], r[k], timestamp);
+		}
+		STATS_TIME_END(write_start, write_ns);
+	}
+}
+
+
+// evaluation and sample output of rows [first, last) of one channel capture, lineid is
+// that of the last output sample before first; returns lineid of the last output sample
+// (segment of parallel processing, on a pool thread: not counted in program_stats)
+template <class Detector>
+static long long write_capture_segment(const CaptureFile& capture, OutputWriter& out, Detector& detector,
+		uint64_t first, uint64_t last, long long lineid) {
+
+	const int64_t* t = capture.timestamps();
+	long utc_offset_sec = capture.header().utc_offset_sec;
+	char tsbuf[TIMESTAMP_TEXT_LEN];
+	std::string_view p1(tsbuf, TIMESTAMP_TEXT_LEN);
+
+	std::vector<int64_t> tbuf(SAMPLE_BATCH_SIZE);
+	std::vector<float> vbuf(SAMPLE_BATCH_SIZE);
+	std::vector<int32_t> ibuf(SAMPLE_BATCH_SIZE);
+	std::vector<AlarmNoiseRejectResult> r(SAMPLE_BATCH_SIZE);
+
+	// int32 columns go to the fixed-point detector as they are (float is exact up to 2^24 only)
+	bool int_values = detector.params().fixed_point && !capture.is_float();
+
+	uint64_t i = first;
+	while (i < last) {
+		const int64_t* tp = tbuf.data();
+		const float* vp = vbuf.data();
+		const int32_t* ip = ibuf.data();
+		size_t n = 0;
+
+		if (detector.params().sample_each == 1) {
+			n = last - i < SAMPLE_BATCH_SIZE ? last - i : SAMPLE_BATCH_SIZE;
+			tp = t + i;
+			if (capture.is_float())
+				vp = capture.float_column(0) + i;
+			else {
+				capture.values(0, i, n, vbuf.data());
+				ip = capture.int_column(0) + i;
+			}
+			i += n;
+		} else {
+			for (; n < SAMPLE_BATCH_SIZE && i < last; i++) {
+				if (!detector.sample())
+					continue;
+				tbuf[n] = t[i];
+				vbuf[n] = capture.value(0, i);
+				if (int_values)
+					ibuf[n] = capture.int_column(0)[i];
+				n++;
+			}
+		}
+
+		if (int_values)
+			detector.process(tp, ip, n, r.data());
+		else
+			detector.process(tp, vp, n, r.data());
+		for (size_t k = 0; k < n; k++) {
+			format_timestamp(tp[k], utc_offset_sec, tsbuf);
+			write_row(out, ++lineid, p1, vp[k], r[k]);
+		}
+	}
+	return lineid;
+}
+
+
+// processing of one channel capture in segments on opts.threads threads (see fp_parallel.h),
+// output is the same as of the sequential processing
+template <class Detector>
+static int run_capture_parallel(const ProgramOptions& opts, const CaptureFile& capture, Detector initial) {
+
+	CaptureCheckpoints embedded;
+	if (!embedded.parse(capture.embedded())) {
+		std::cerr << opts.capture_file << ": " << embedded.error() << std::endl;
+		return 1;
+	}
+
+	// segments start at checkpoints: at the embedded ones nearest to even splits if they are
+	// of the same parameters, else at even splits with speculatively found states
+	uint64_t size = capture.size();
+	size_t count = opts.threads * PARALLEL_SEGMENTS_PER_THREAD;
+	std::vector<CaptureCheckpoint> starts;
+	if (!embedded.list.empty() && embedded.params == initial.params()) {
+		for (uint64_t row : segment_rows(size, count, 1)) {
+			auto it = std::lower_bound(embedded.list.begin(), embedded.list.end(), row,
+					[](const CaptureCheckpoint& c, uint64_t row) { return c.row < row; });
+			if (it != embedded.list.end() && it->row < size && (starts.empty() || it->row > starts.back().row))
+				starts.push_back(*it);
+		}
+	} else if (size) {
+		std::vector<uint64_t> rows = segment_rows(size, count, initial.params().sample_each);
+		starts = speculate_checkpoints(capture, initial, rows, opts.warmup, opts.threads).list;
+	}
+
+	// lineid and state at the end of each segment, for counters
+	std::vector<long long> end_lineid(starts.size() + 1);
+	std::vector<AlarmNoiseRejectState> end_state(starts.size() + 1);
+
+	OutputWriter out(STDOUT_FILENO, opts.flush_policy);
+	write_header(out, nullptr);
+	program_stats.stage_timing = STAGES_READ_ONLY;
+
+	ParallelSegments segments(opts.threads);
+	segments.run(starts.size() + 1, out, [&](size_t k, OutputWriter& segment_out) {
+		Detector detector = initial;
+		uint64_t first = 0;
+		long long lineid = 0;
+		if (k) {
+			detector.set_state(starts[k - 1].state);
+			first = starts[k - 1].row;
+			lineid = starts[k - 1].lineid;
+		}
+		uint64_t last = k < starts.size() ? starts[k].row : size;
+		end_lineid[k] = write_capture_segment(capture, segment_out, detector, first, last, lineid);
+		end_state[k] = detector.state();
+	}, [&](size_t k) {
+		// patterns and alarms of the segment follow from patternid at its ends
+		AlarmNoiseRejectState start = k ? starts[k - 1].state : initial.state();
+		uint64_t first = k ? starts[k - 1].row : 0;
+		uint64_t last = k < starts.size() ? starts[k].row : size;
+		[[maybe_unused]] int started = end_state[k].patternid - start.patternid;
+		STATS_ADD(lines, last - first);
+		STATS_ADD(samples, end_lineid[k] - (k ? starts[k - 1].lineid : 0));
+		STATS_ADD(alarms, started);
+		STATS_ADD(patterns, started + start.ispattern - end_state[k].ispattern);
+		if (last > first)
+			STATS_SET(last_sample_usec, capture.timestamps()[last - 1]);
+		out.input_block_end();
+	});
+	if (!segments.error().empty()) {
+		std::cerr << segments.error() << std::endl;
+		return 1;
+	}
+
+	out.flush();
+	if (out.failed()) {
+		std::cerr << "Output write error: " << strerror(out.error()) << std::endl;
+		return 1;
+	}
+	return 0;
+}
+
+
+// processing of capture file, columns are evaluated directly from the mapped file
+// (one channel: all samples are output as for text input, more channels: events)
+static int run_capture(const ProgramOptions& opts, const AlarmNoiseRejectParams& params) {
+
+	CaptureFile capture;
+	if (!capture.open(opts.capture_file)) {
+		std::cerr << capture.error() << std::endl;
+		return 1;
+	}
+
+	uint64_t size = capture.size();
+	size_t channels = capture.channels();
+	const int64_t* t = capture.timestamps();
+	long utc_offset_sec = capture.header().utc_offset_sec;
+	if (channels > 1 && params.fixed_point) {
+		std::cerr << "Arguments error: --arithmetic fixed is supported for one channel only" << std::endl;
+		return 1;
+	}
+	if (channels > 1 && opts.events_output) {
+		std::cerr << "Arguments error: --output events is supported for one channel only "
+			"(a capture of more channels outputs events of all channels)" << std::endl;
+		return 1;
+	}
+	if (opts.threads > 1) {
+		if (channels > 1) {
+			std::cerr << "Arguments error: --threads is supported for one channel captures only" << std::endl;
+			return 1;
+		}
+		return dispatch_detector(params, [&](auto detector) { return run_capture_parallel(opts, capture, detector); });
+	}
+	char tsbuf[TIMESTAMP_TEXT_LEN];
+	std::string_view p1(tsbuf, TIMESTAMP_TEXT_LEN);
+
+	// buffered output, input has no blocks
+	LatencyTracker latency_tracker(program_stats.latency_rows, program_stats.latency_alarms, opts.latency_every);
+	OutputWriter out(STDOUT_FILENO, opts.flush_policy);
+
+	if (channels > 1) {
+		out.put("lineid;timestamp;channel;event;meas;curavg;patternid");
+		out.end_row();
+
+		MultiChannelDetector detector(channels, params);
+		ChannelLastRow last(channels);
+		char last_tsbuf[TIMESTAMP_TEXT_LEN];
+		program_stats.stage_timing = STAGES_READ_ONLY;
+		std::vector<float> row(channels);
+		int cursample = params.sample_each;
+		long long lineid = 0;
+
+		for (uint64_t i = 0; i < size; i++) {
+			STATS_ADD(lines, 1);
+			if (cursample-- > 1) {
+				STATS_ADD(sampled_out, 1);
+				continue;
+			}
+			cursample = params.sample_each;
+
+			for (size_t ch = 0; ch < channels; ch++)
+				row[ch] = capture.value(ch, i);
+			lineid++;
+			STATS_ADD(samples, 1);
+			STATS_SET(last_sample_usec, t[i]);
+
+			// timestamps are formatted only when output
+			if (detector.push(t[i], row.data())) {
+				format_timestamp(t[i], utc_offset_sec, tsbuf);
+				format_timestamp(last.t_usec, utc_offset_sec, last_tsbuf);
+				write_channel_events(out, lineid, p1, detector, last, std::string_view(last_tsbuf, TIMESTAMP_TEXT_LEN));
+			}
+			last.set(lineid, t[i], detector);
+		}
+	} else {
+		LatencyTracker* latency = track_output_latency(opts, latency_tracker, out);
+		EventWriter event_writer(out, opts.heartbeat_usec);
+		EventWriter* events = opts.events_output ? &event_writer : nullptr;
+		write_header(out, events);
+
+		PatternFile pattern_file;
+		if (opts.patterns_file && !pattern_file.open(opts.patterns_file, opts.patterns_binary, opts.pattern_pre, opts.pattern_post))
+			return 1;
+		PatternExtractor* patterns = pattern_file.extractor();
+
+		AlarmNotifier alarm_notifier(opts.alarm_fd);
+		AlarmNotifier* alarms = start_alarm_notifier(opts, alarm_notifier);
+
+		dispatch_detector(params, [&](auto detector) {
+			process_capture_channel(capture, out, events, patterns, latency, alarms, detector);
+		});
+		if (!pattern_file.close() || !alarm_notifier_ok(alarms))
+			return 1;
+	}
+
+	out.flush();
+	if (out.failed()) {
+		std::cerr << "Output write error: " << strerror(out.error()) << std::endl;
+		return 1;
+	}
+
+	return 0;
+}
+
+
+// evaluation of all parameter sets of the sweep file in one pass over timestamp;value lines on stdin
+static int run_sweep(const ProgramOptions& opts) {
+
+	std::vector<AlarmNoiseRejectParams> sets;
+	if (!read_sweep_file(opts.sweep_file, sets))
+		return 1;
+
+	// optional list of all patterns
+	int patterns_fd = -1;
+	if (opts.sweep_patterns_file) {
+		patterns_fd = open(opts.sweep_patterns_file, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+		if (patterns_fd < 0) {
+			std::cerr << "Cannot open " << opts.sweep_patterns_file << ": " << strerror(errno) << std::endl;
+			return 1;
+		}
+	}
+	OutputWriter patterns(patterns_fd, FLUSH_EXIT);
+	if (patterns_fd >= 0) {
+		patterns.put("set;patternid;timestamp");
+		patterns.end_row();
+	}
+
+	// variables for read data and parsing
+	InputReader reader(STDIN_FILENO);
+	std::string_view lineread, p1;
+	double parsedval;
+	TimestampDecoder tsdecoder(opts.utc_offset_sec);
+	int64_t curtime;
+
+	// one detector lane per parameter set, each lane does its own sampling
+	MultiChannelDetector detector(sets);
+	std::vector<SweepSummary> summary(sets.size());
+
+	while (reader.next_line(lineread)) {
+		STATS_ADD(lines, 1);
+		if (!parse_sample(lineread, tsdecoder, p1, curtime, parsedval, false)) {
+			detector.skip();
+			continue;
+		}
+
+		if (!detector.push_all(curtime, parsedval))
+			continue;
+
+		for (size_t i = 0; i < sets.size(); i++) {
+			if (!(detector.event(i) & CHANNEL_EVENT_ALARM))
+				continue;
+			SweepSummary& sum = summary[i];
+			if (!sum.alarms++)
+				sum.first_alarm = p1;
+			sum.last_alarm = p1;
+			if (patterns_fd >= 0) {
+				patterns.put_int(i); patterns.put(';');
+				patterns.put_int(detector.patternid(i)); patterns.put(';');
+				patterns.put(p1);
+				patterns.end_row();
+			}
+		}
+	}
+
+	if (reader.failed()) {
+		std::cerr << "Input read error: " << strerror(reader.error()) << std::endl;
+		return 1;
 	}
-	size_t last = str.find_last_not_of(' ');
-	return str.substr(first, (last - first + 1));
+
+	// output summary
+	OutputWriter out(STDOUT_FILENO, FLUSH_EXIT);
+	out.put("set;sample_each;initial_avg_diff;number_of_points_to_alarm;wait_state_usec;"
+			"multiplicator_to_detect;n_amend_avgdiff;pattern_state_usec;alarms;first_alarm;last_alarm");
+	out.end_row();
+	for (size_t i = 0; i < sets.size(); i++) {
+		const AlarmNoiseRejectParams& p = sets[i];
+		out.put_int(i); out.put(';');
+		out.put_int(p.sample_each); out.put(';'); out.put_float(p.initial_avg_diff); out.put(';');
+		out.put_int(p.number_of_points_to_alarm); out.put(';'); out.put_int(p.wait_state_usec); out.put(';');
+		out.put_int(p.multiplicator_to_detect); out.put(';'); out.put_int(p.n_amend_avgdiff); out.put(';');
+		out.put_int(p.pattern_state_usec); out.put(';');
+		out.put_int(summary[i].alarms); out.put(';');
+		out.put(summary[i].first_alarm); out.put(';'); out.put(summary[i].last_alarm);
+		out.end_row();
+	}
+
+	patterns.flush();
+	out.flush();
+	if (patterns.failed() || out.failed()) {
+		std::cerr << "Output write error: " << strerror(out.failed() ? out.error() : patterns.error()) << std::endl;
+		return 1;
+	}
+	if (patterns_fd >= 0)
+		close(patterns_fd);
+
+	return 0;
 }
 
 
+int main(int argc, char* argv[]) {
+
+	// detector parameters, defaults see fp_detector.h
+	AlarmNoiseRejectParams params;
+
+
+	// arguments evaluation
+	// program to be called with either none or all seven integer arguments in the order:
+
+	/* SAMPLE_EACH
+	 * INITIAL_AVG_DIFF
+	 * NUMBER_OF_POINTS_TO_ALARM
+	 * WAIT_STATE_USEC
+	 * MULTIPLICATOR_TO_DETECT
+	 * N_AMEND_AVGDIFF
+	 * PATTERN_STATE_USEC
+	 *
+	 * options (see fp_options.h) may be passed in addition
+	 */
+
+	ProgramOptions opts;
+	if (!parse_options(argc, argv, opts)) {
+		std::cerr << "Program terminated" << std::endl;
+		return 1;
+	}
+	size_t nargs = opts.positional.size();
+	char** args = opts.positional.data();
+
+	// if at least one argument passed, evaluate number of them
+	if (nargs != 0 && nargs != 7) {
+		std::cerr << "Arguments error: must pass 7 integer arguments or none" << std::endl;
+		std::cerr << "Number of arguments passed: " << nargs << std::endl;
+		std::cerr << "Program terminated" << std::endl;
+		return 1;
+	}
+
+	// parse arguments
+	if (nargs == 7) {
+		try {
+		params.sample_each = atoi(args[0]);
+		params.initial_avg_diff = atoi(args[1]);
+		params.number_of_points_to_alarm = atoi(args[2]);
+		params.wait_state_usec = atoi(args[3]);
+		params.multiplicator_to_detect = atoi(args[4]);
+		params.n_amend_avgdiff = atoi(args[5]);
+		params.pattern_state_usec = atoi(args[6]);
+		} catch (const std::exception &exc) {
+			std::cerr << "Arguments parsing error (must pass 7 integer arguments)";
+			std::cerr << exc.what() << std::endl;
+			return 1;
+		}
+	}
+
+	params.fixed_point = opts.fixed_point;
+
+	// calibrated noise level replaces the guessed one
+	if (opts.profile_file) {
+		NoiseProfile profile;
+		if (!profile.load(opts.profile_file)) {
+			std::cerr << profile.error() << std::endl;
+			return 1;
+		}
+		params.initial_avg_diff = profile.initial_avg_diff < 1 ? 1 : profile.initial_avg_diff;
+	}
+
+	// verify (somehow) values of arguments
+	if (!params.valid()) {
+	std::cerr << std::endl << "Invalid argument(s) value(s):" << std::endl;
+	std::cerr << "=============================" << std::endl;
+	params.print(std::cerr);
+	std::cerr << std::endl << "Exiting..." << std::endl << std::endl;
+
+	// error exit
+	return 1;
+	}
+
+
+
+	// start processing //
+
+	// multichannel output is events only, sweep output is a summary
+	if (opts.events_output && (opts.channels > 1 || opts.binary_frames)) {
+		std::cerr << "Arguments error: --output events is supported for one channel only "
+			"(--channels N outputs events of all channels)" << std::endl;
+		return 1;
+	}
+	if (opts.events_output && opts.sweep_file) {
+		std::cerr << "Arguments error: --output events is not supported with --sweep (summary of parameter sets)" << std::endl;
+		return 1;
+	}
+
+	// multichannel and sweep lanes are float only
+	if (opts.fixed_point && (opts.channels > 1 || opts.binary_frames || opts.sweep_file)) {
+		std::cerr << "Arguments error: --arithmetic fixed is supported for one channel only" << std::endl;
+		return 1;
+	}
+
+	// checkpoints are supported for plain processing of stdin only
+	if (opts.resume && !opts.checkpoint_file) {
+		std::cerr << "Arguments error: --resume requires --checkpoint" << std::endl;
+		return 1;
+	}
+	if (opts.checkpoint_file && (opts.pipeline || opts.events_output || opts.patterns_file || opts.channels > 1
+			|| opts.binary_frames || opts.capture_file || opts.convert_file || opts.shm_name || opts.listen_address
+			|| opts.sweep_file)) {
+		std::cerr << "Arguments error: --checkpoint is supported for one channel sample output from stdin only" << std::endl;
+		return 1;
+	}
+
+	// embedded checkpoints and parallel processing are for captures, sample output only
+	if (opts.embed_checkpoints && !opts.convert_file && !opts.capture_file) {
+		std::cerr << "Arguments error: --embed-checkpoints requires --convert-to or --capture" << std::endl;
+		return 1;
+	}
+	if (opts.embed_checkpoints && opts.convert_file && opts.channels > 1) {
+		std::cerr << "Arguments error: --embed-checkpoints is supported for one channel captures only" << std::endl;
+		return 1;
+	}
+	if (opts.threads > 1 && (!opts.capture_file || opts.embed_checkpoints || opts.calibrate_file
+			|| opts.events_output || opts.patterns_file || opts.alarm_fd >= 0 || opts.latency_every)) {
+		std::cerr << "Arguments error: --threads is supported for sample output of --capture only" << std::endl;
+		return 1;
+	}
+
+	// counters are reported by their own thread, SIGUSR1 is taken by it only
+	StatsReporter::block_signal();
+	StatsReporter stats_reporter;
+	stats_reporter.start(opts.stats_interval_sec);
+
+	if (opts.sweep_file) {
+		if (nargs) {
+			std::cerr << "Arguments error: parameters are taken from the sweep file, do not pass them" << std::endl;
+			return 1;
+		}
+		return run_sweep(opts);
+	}
 
+	if (opts.convert_file)
+		return run_convert(opts, params);
 
+	if (opts.embed_checkpoints)
+		return embed_checkpoints(opts.capture_file, opts, params);
 
+	if (opts.calibrate_file)
+		return run_calibrate(opts, params);
 
+	if (opts.listen_address)
+		return dispatch_detector(params, [&](auto detector) { return run_server(opts, detector); });
+
+	if (opts.shm_name)
+		return dispatch_detector(params, [&](auto detector) { return run_shm(opts, detector); });
+
+	if (opts.capture_file)
+		return run_capture(opts, params);
+
+	if (opts.channels > 1 || opts.binary_frames)
+		return run_multichannel(opts, params);
+
+	if (opts.pipeline)
+		return dispatch_detector(params, [&](auto detector) { return run_single_channel_pipeline(opts, detector); });
+
+	return dispatch_detector(params, [&](auto detector) { return run_single_channel(opts, detector); });
+}
@@ -0,0 +1,177 @@
+//============================================================================
+// Name        : fp_histogram.h
+// Description : Log-linear latency histogram and read-to-emit latency tracking
+//============================================================================
+
+/*
+LatencyHistogram counts values (nanoseconds) in buckets of HDR histogram
+layout: values below 2^LATENCY_SUB_BITS have a bucket each, every further
+power of two range is split into 2^(LATENCY_SUB_BITS - 1) buckets of equal
+width, so the relative error of a reported value is below 1/2^(LATENCY_SUB_BITS - 1)
+over the whole range. Percentiles are reported as the highest value of
+their bucket. One thread records, any thread may read (relaxed atomics).
+
+LatencyTracker measures the delay between a sample entering the process and
+its output row leaving it by write(). Read time of a sample is the end of the
+read() of its input block (or, for memory mapped input, the time the first
+sample of its batch was parsed), rows put into the output buffer are kept
+pending with their read time until the buffer is written:
+
+LatencyTracker latency(rows_histogram, alarms_histogram, every);
+out.set_write_hook([&] { latency.emitted(); });
+...
+latency.row(read_ns, alarm);   // before the row is formatted
+out.put(...);
+
+With every > 1, only every n-th row is tracked in the rows histogram (less
+bookkeeping per row), alarm rows are always tracked in the alarms histogram.
+ */
+
+#ifndef FP_HISTOGRAM_H_
+#define FP_HISTOGRAM_H_
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <vector>
+
+// Bits of value resolution of histogram buckets (7: below 1.6% relative error)
+#define LATENCY_SUB_BITS 7
+
+#define LATENCY_SUB_COUNT (1 << LATENCY_SUB_BITS)
+#define LATENCY_BUCKETS (LATENCY_SUB_COUNT + (64 - LATENCY_SUB_BITS) * (LATENCY_SUB_COUNT / 2))
+
+class LatencyHistogram {
+public:
+	// adds count values of value ns
+	void record(uint64_t value, uint64_t count = 1) {
+		add(counts[bucket(value)], count);
+		add(total, count);
+		add(sum, value * count);
+		if (value > max.load(std::memory_order_relaxed))
+			max.store(value, std::memory_order_relaxed);
+		if (value < min.load(std::memory_order_relaxed))
+			min.store(value, std::memory_order_relaxed);
+	}
+
+	uint64_t count() const { return total.load(std::memory_order_relaxed); }
+
+	// number of values in bucket i
+	uint64_t bucket_count(int i) const { return counts[i].load(std::memory_order_relaxed); }
+
+	// highest value of the bucket holding the q-quantile (0 <= q <= 1)
+	uint64_t percentile(double q) const {
+		uint64_t n = count();
+		if (!n)
+			return 0;
+		uint64_t rank = static_cast<uint64_t>(q * n + 0.5);
+		if (rank < 1)
+			rank = 1;
+		uint64_t seen = 0;
+		for (int i = 0; i < LATENCY_BUCKETS; i++) {
+			seen += counts[i].load(std::memory_order_relaxed);
+			if (seen >= rank)
+				return std::min(bucket_high(i), max.load(std::memory_order_relaxed));
+		}
+		return max.load(std::memory_order_relaxed);
+	}
+
+	// prints "name: count N, min, p50 ... max, mean" in microseconds
+	void print(FILE* f, const char* name) const {
+		uint64_t n = count();
+		if (!n) {
+			fprintf(f, "%s: count 0\n", name);
+			return;
+		}
+		fprintf(f, "%s: count %llu, min %.1f, p50 %.1f, p90 %.1f, p99 %.1f, p99.9 %.1f, p99.99 %.1f, max %.1f, mean %.1f us\n",
+			name, (unsigned long long) n, min.load(std::memory_order_relaxed) * 1e-3,
+			percentile(0.5) * 1e-3, percentile(0.9) * 1e-3, percentile(0.99) * 1e-3,
+			percentile(0.999) * 1e-3, percentile(0.9999) * 1e-3,
+			max.load(std::memory_order_relaxed) * 1e-3,
+			static_cast<double>(sum.load(std::memory_order_relaxed)) / n * 1e-3);
+	}
+
+	// bucket index of value
+	static int bucket(uint64_t value) {
+		if (value < LATENCY_SUB_COUNT)
+			return static_cast<int>(value);
+		int shift = 63 - __builtin_clzll(value) - (LATENCY_SUB_BITS - 1);
+		return LATENCY_SUB_COUNT + (shift - 1) * (LATENCY_SUB_COUNT / 2)
+			+ static_cast<int>(value >> shift) - LATENCY_SUB_COUNT / 2;
+	}
+
+	// highest value of bucket i
+	static uint64_t bucket_high(int i) {
+		if (i < LATENCY_SUB_COUNT)
+			return i;
+		int k = i - LATENCY_SUB_COUNT;
+		int shift = k / (LATENCY_SUB_COUNT / 2) + 1;
+		uint64_t m = k % (LATENCY_SUB_COUNT / 2) + LATENCY_SUB_COUNT / 2;
+		return ((m + 1) << shift) - 1;
+	}
+
+private:
+	// single writer, no locked instruction
+	static void add(std::atomic<uint64_t>& a, uint64_t n) {
+		a.store(a.load(std::memory_order_relaxed) + n, std::memory_order_relaxed);
+	}
+
+	std::atomic<uint64_t> counts[LATENCY_BUCKETS] = {};
+	std::atomic<uint64_t> total{0}, sum{0}, max{0}, min{UINT64_MAX};
+};
+
+
+class LatencyTracker {
+public:
+	// every: track each n-th row in rows (>= 1)
+	LatencyTracker(LatencyHistogram& rows, LatencyHistogram& alarms, long every)
+		: rows(rows), alarms(alarms), every(every), countdown(every) {}
+
+	// row of sample read at read_ns (steady clock) is put into output buffer
+	void row(int64_t read_ns, bool alarm) {
+		bool tracked = --countdown == 0;
+		if (tracked)
+			countdown = every;
+		else if (!alarm)
+			return;
+		if (!pending.empty() && pending.back().read_ns == read_ns) {
+			pending.back().rows += tracked;
+			pending.back().alarms += alarm;
+		} else
+			pending.push_back({ read_ns, tracked, alarm });
+	}
+
+	// output buffer has been written, all pending rows are out
+	void emitted() {
+		if (pending.empty())
+			return;
+		int64_t now = std::chrono::duration_cast<std::chrono::nanoseconds>(
+			std::chrono::steady_clock::now().time_since_epoch()).count();
+		for (const Pending& p : pending) {
+			uint64_t latency = now > p.read_ns ? now - p.read_ns : 0;
+			if (p.rows)
+				rows.record(latency, p.rows);
+			if (p.alarms)
+				alarms.record(latency, p.alarms);
+		}
+		pending.clear();
+	}
+
+private:
+	// rows of the same read time
+	struct Pending {
+		int64_t read_ns;
+		uint32_t rows;
+		uint32_t alarms;
+	};
+
+	LatencyHistogram& rows;
+	LatencyHistogram& alarms;
+	long every;
+	long countdown;
+	std::vector<Pending> pending;
+};
+
+#endif /* FP_HISTOGRAM_H_ */
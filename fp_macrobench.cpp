@@ -0,0 +1,410 @@
+//============================================================================
+// Name        : fp_macrobench.cpp
+// Description : End-to-end throughput benchmark of fp_generate_patterns
+//============================================================================
+
+/*
+Runs the complete program on generated inputs (see fp_synth.h) for all
+combinations of input size, alarm density, channel count and thread mode,
+and reports for each run:
+
+samples;rows;channels;burst_probability;mode;threads;wall_sec;samples_per_sec;peak_rss_kb;output_bytes;verified
+
+Output of every run is hashed while it is read from the program and compared
+with the output of the reference implementation below, which follows the
+original main() loop (std::getline, sscanf, std::stod, float state machine,
+std::ostream formatting) independently of the program sources. verified is
+ok, FAILED or skipped (inputs above --verify-max samples).
+
+to be run from Debug/ using e.g.:
+./fp_macrobench --sizes 1000000,10000000 --channels 1,4 > macrobench.csv
+
+options:
+--program PATH      program to measure, default ./fp_generate_patterns
+--sizes LIST        numbers of samples (rows x channels), default 1000000,10000000
+--densities LIST    burst probabilities per sample, default 0.00001,0.001
+--channels LIST     channel counts, default 1,4,16
+--modes LIST        single (1 thread), pipeline (3 threads, one channel only), default both
+--dir DIR           directory of generated inputs, default /tmp
+--verify-max N      largest input verified against the reference, default 100000000
+--keep              keep generated inputs
+
+Exit code is 1 if any run failed verification.
+ */
+
+#include <iostream>
+#include <fstream>
+#include <sstream>
+#include <string>
+#include <vector>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <cerrno>
+#include <ctime>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/resource.h>
+#include <sys/wait.h>
+
+#include "fp_detector.h"
+#include "fp_synth.h"
+
+// FNV-1a hash and size of a byte stream
+struct StreamHash {
+	uint64_t hash = 14695981039346656037ULL;
+	uint64_t bytes = 0;
+
+	void add(const char* data, size_t n) {
+		uint64_t h = hash;
+		for (size_t i = 0; i < n; i++) {
+			h ^= static_cast<unsigned char>(data[i]);
+			h *= 1099511628211ULL;
+		}
+		hash = h;
+		bytes += n;
+	}
+
+	bool operator==(const StreamHash& other) const { return hash == other.hash && bytes == other.bytes; }
+};
+
+// stream buffer hashing everything written to it
+class HashBuf : public std::streambuf {
+public:
+	explicit HashBuf(StreamHash& h) : h(h) { setp(buf, buf + sizeof(buf)); }
+	~HashBuf() { sync(); }
+
+protected:
+	int overflow(int ch) override {
+		sync();
+		if (ch != EOF) {
+			*pptr() = ch;
+			pbump(1);
+		}
+		return ch;
+	}
+
+	int sync() override {
+		h.add(pbase(), pptr() - pbase());
+		setp(buf, buf + sizeof(buf));
+		return 0;
+	}
+
+private:
+	StreamHash& h;
+	char buf[1 << 16];
+};
+
+
+////////////////////////////////////////////////////////////////////////////////////////
+// reference implementation
+////////////////////////////////////////////////////////////////////////////////////////
+
+// state of one channel as in the original loop
+struct ReferenceChannel {
+	float diffavg = INITIAL_AVG_DIFF;
+	float lastval = 0;
+	int numthresholded = NUMBER_OF_POINTS_TO_ALARM;
+	short isalarm = 0, iswait = 0, ispattern = 0;
+	int patternid = 0;
+	int64_t alarmraisetime = 0, patternraisetime = 0;
+	int shown = 0;   // patternid output at the previous row
+
+	// original evaluation of one value, returns diffnoabs
+	float step(bool first, int64_t curtime, float curval) {
+		if (first)
+			lastval = curval;
+		float diffnoabs = curval - lastval;
+		// as the original abs(float), resolving to abs(int)
+		float diff = std::abs(static_cast<int>(diffnoabs));
+
+		if (ispattern == 1 && curtime - patternraisetime > PATTERN_STATE_USEC)
+			ispattern = 0;
+
+		if (iswait == 1) {
+			isalarm = 0;
+			if (curtime - alarmraisetime > WAIT_STATE_USEC)
+				iswait = 0;
+		} else {
+			if (diff < MULTIPLICATOR_TO_DETECT * diffavg)
+				numthresholded = NUMBER_OF_POINTS_TO_ALARM;
+			else if (--numthresholded == 0) {
+				isalarm = 1;
+				alarmraisetime = curtime;
+				iswait = 1;
+				numthresholded = NUMBER_OF_POINTS_TO_ALARM;
+				patternid++;
+				ispattern = 1;
+				patternraisetime = curtime;
+			}
+		}
+
+		if (iswait == 0 && numthresholded == NUMBER_OF_POINTS_TO_ALARM)
+			diffavg = (diffavg * (N_AMEND_AVGDIFF - 1) + diff) / N_AMEND_AVGDIFF;
+
+		lastval = curval;
+		return diffnoabs;
+	}
+};
+
+// expected output of the program with default parameters for input file
+static bool reference_output(const std::string& input, size_t channels, StreamHash& hash) {
+	std::ifstream in(input);
+	if (!in)
+		return false;
+	HashBuf buf(hash);
+	std::ostream out(&buf);
+
+	std::vector<ReferenceChannel> ch(channels);
+	std::vector<float> values(channels);
+	std::string lineread, p1;
+	long long lineid = 0;
+
+	if (channels == 1)
+		out << "lineid;timestamp;meas;diff;curavg;isdetect;isalarm;iswait;patternid" << '\n';
+	else
+		out << "lineid;timestamp;channel;event;meas;curavg;patternid" << '\n';
+
+	while (std::getline(in, lineread)) {
+		size_t pos = lineread.find(';');
+		if (pos == std::string::npos)
+			continue;
+		p1 = lineread.substr(0, pos);
+		const char* p = lineread.c_str() + pos;
+		for (size_t c = 0; c < channels; c++) {
+			char* endp;
+			values[c] = strtod(p + 1, &endp);
+			p = endp;
+		}
+
+		int d, m, y, h, mi, s, us;
+		sscanf(p1.c_str(), "%d-%d-%d %d:%d:%d.%d", &d, &m, &y, &h, &mi, &s, &us);
+		struct tm t = {0};
+		t.tm_year = y - 1900; t.tm_mon = m - 1; t.tm_mday = d; t.tm_hour = h; t.tm_min = mi; t.tm_sec = s;
+		int64_t curtime = static_cast<int64_t>(timegm(&t)) * 1000000 + us;
+
+		bool first = !lineid++;
+		for (size_t c = 0; c < channels; c++) {
+			ReferenceChannel& r = ch[c];
+			float diffnoabs = r.step(first, curtime, values[c]);
+			int shown = r.ispattern ? r.patternid : 0;
+
+			if (channels == 1) {
+				out << lineid << ';' << p1 << ";";
+				out << values[c] << ";" << diffnoabs << ";" << r.diffavg << ";";
+				out << (r.numthresholded == NUMBER_OF_POINTS_TO_ALARM ? 0 : 1) << ";";
+				out << r.isalarm << ";";
+				out << r.iswait << ";" << shown << '\n';
+			} else {
+				if (r.shown && shown != r.shown)
+					out << lineid << ';' << p1 << ';' << c << ";pattern_end;" << values[c] << ';' << r.diffavg << ';' << r.shown << '\n';
+				if (r.isalarm)
+					out << lineid << ';' << p1 << ';' << c << ";alarm;" << values[c] << ';' << r.diffavg << ';' << shown << '\n';
+			}
+			r.shown = shown;
+		}
+	}
+	return true;
+}
+
+////////////////////////////////////////////////////////////////////////////////////////
+// end of reference implementation
+////////////////////////////////////////////////////////////////////////////////////////
+
+
+// writes input of rows x channels generated samples, false on error
+static bool generate_input(const std::string& filename, long long rows, size_t channels, double density) {
+	int fd = open(filename.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+	if (fd < 0)
+		return false;
+
+	std::vector<SynthSource> sources;
+	for (size_t c = 0; c < channels; c++) {
+		SynthParams p;
+		p.burst_probability = density;
+		p.seed = c + 1;
+		sources.emplace_back(p);
+	}
+	std::vector<float> values(channels);
+	std::string text;
+	bool ok = true;
+	for (long long i = 0; i < rows && ok; i++) {
+		int64_t t = 0;
+		for (size_t c = 0; c < channels; c++)
+			sources[c].next(t, values[c]);
+		synth_line(t, values.data(), channels, 0, text);
+		if (text.size() >= (1 << 20) || i + 1 == rows) {
+			ok = write(fd, text.data(), text.size()) == static_cast<ssize_t>(text.size());
+			text.clear();
+		}
+	}
+	return close(fd) == 0 && ok;
+}
+
+struct RunResult {
+	double wall_sec = 0;
+	long peak_rss_kb = 0;
+	StreamHash output;
+	bool ok = false;
+};
+
+// runs program with input file on stdin, output is hashed
+static RunResult run_program(const std::string& program, const std::vector<std::string>& args, const std::string& input) {
+	RunResult result;
+	int in = open(input.c_str(), O_RDONLY);
+	int fds[2];
+	if (in < 0 || pipe(fds) != 0)
+		return result;
+
+	auto start = std::chrono::steady_clock::now();
+	pid_t pid = fork();
+	if (pid == 0) {
+		dup2(in, STDIN_FILENO);
+		dup2(fds[1], STDOUT_FILENO);
+		close(fds[0]);
+		close(fds[1]);
+		close(in);
+		std::vector<char*> argv;
+		argv.push_back(const_cast<char*>(program.c_str()));
+		for (const std::string& a : args)
+			argv.push_back(const_cast<char*>(a.c_str()));
+		argv.push_back(nullptr);
+		execv(program.c_str(), argv.data());
+		_exit(127);
+	}
+	close(fds[1]);
+	close(in);
+
+	std::vector<char> buf(1 << 20);
+	for (;;) {
+		ssize_t n = read(fds[0], buf.data(), buf.size());
+		if (n < 0 && errno == EINTR)
+			continue;
+		if (n <= 0)
+			break;
+		result.output.add(buf.data(), n);
+	}
+	close(fds[0]);
+
+	int status;
+	struct rusage usage;
+	if (pid < 0 || wait4(pid, &status, 0, &usage) != pid)
+		return result;
+	result.wall_sec = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+	result.peak_rss_kb = usage.ru_maxrss;
+	result.ok = WIFEXITED(status) && WEXITSTATUS(status) == 0;
+	return result;
+}
+
+// comma separated list of values
+template <class T>
+static bool parse_list(const char* text, std::vector<T>& out) {
+	out.clear();
+	std::istringstream in(text);
+	std::string item;
+	while (std::getline(in, item, ',')) {
+		std::istringstream value(item);
+		T v;
+		if (!(value >> v))
+			return false;
+		out.push_back(v);
+	}
+	return !out.empty();
+}
+
+
+int main(int argc, char* argv[]) {
+	std::string program = "./fp_generate_patterns";
+	std::string dir = "/tmp";
+	std::vector<long long> sizes = { 1000000, 10000000 };
+	std::vector<double> densities = { 0.00001, 0.001 };
+	std::vector<size_t> channel_counts = { 1, 4, 16 };
+	std::vector<std::string> modes = { "single", "pipeline" };
+	long long verify_max = 100000000;
+	bool keep = false;
+
+	for (int i = 1; i < argc; i++) {
+		std::string arg = argv[i];
+		const char* value = i + 1 < argc ? argv[i + 1] : nullptr;
+		bool ok = true;
+		if (arg == "--keep") {
+			keep = true;
+			continue;
+		}
+		if (!value)
+			ok = false;
+		else if (arg == "--program")
+			program = value;
+		else if (arg == "--dir")
+			dir = value;
+		else if (arg == "--sizes")
+			ok = parse_list(value, sizes);
+		else if (arg == "--densities")
+			ok = parse_list(value, densities);
+		else if (arg == "--channels")
+			ok = parse_list(value, channel_counts);
+		else if (arg == "--modes")
+			ok = parse_list(value, modes);
+		else if (arg == "--verify-max")
+			verify_max = atoll(value);
+		else
+			ok = false;
+		if (!ok) {
+			std::cerr << "Invalid option " << arg << ", see fp_macrobench.cpp for usage" << std::endl;
+			return 1;
+		}
+		i++;
+	}
+
+	std::cout << "samples;rows;channels;burst_probability;mode;threads;wall_sec;samples_per_sec;peak_rss_kb;output_bytes;verified" << std::endl;
+
+	bool failed = false;
+	for (long long size : sizes) {
+		for (size_t channels : channel_counts) {
+			for (double density : densities) {
+				long long rows = size / channels;
+				std::string input = dir + "/fp_macrobench_" + std::to_string(rows) + "x" + std::to_string(channels) +
+						"_" + std::to_string(density) + ".csv";
+				if (!generate_input(input, rows, channels, density)) {
+					std::cerr << "Cannot write input " << input << ": " << strerror(errno) << std::endl;
+					return 1;
+				}
+
+				StreamHash expected;
+				bool verify = rows * static_cast<long long>(channels) <= verify_max;
+				if (verify && !reference_output(input, channels, expected)) {
+					std::cerr << "Cannot read input " << input << std::endl;
+					return 1;
+				}
+
+				for (const std::string& mode : modes) {
+					// pipeline runs for one channel only
+					if (mode == "pipeline" && channels > 1)
+						continue;
+					std::vector<std::string> args;
+					if (channels > 1)
+						args = { "--channels", std::to_string(channels) };
+					if (mode == "pipeline")
+						args.push_back("--pipeline");
+
+					RunResult r = run_program(program, args, input);
+					const char* verified = !r.ok ? "FAILED" : !verify ? "skipped" : r.output == expected ? "ok" : "FAILED";
+					if (!strcmp(verified, "FAILED"))
+						failed = true;
+
+					long long samples = rows * static_cast<long long>(channels);
+					std::cout << samples << ';' << rows << ';' << channels << ';' << density << ';'
+						<< mode << ';' << (mode == "pipeline" ? 3 : 1) << ';' << r.wall_sec << ';'
+						<< static_cast<long long>(samples / r.wall_sec) << ';' << r.peak_rss_kb << ';'
+						<< r.output.bytes << ';' << verified << std::endl;
+				}
+
+				if (!keep)
+					unlink(input.c_str());
+			}
+		}
+	}
+
+	return failed ? 1 : 0;
+}
@@ -0,0 +1,341 @@
+//============================================================================
+// Name        : fp_multichannel.h
+// Description : alarm_noisereject detector for many channels at once
+//============================================================================
+
+/*
+Runs the same algorithm as AlarmNoiseRejectDetector on N channels sampled at
+the same times (one timestamp + N values per row). State of all channels is
+kept in structure-of-arrays form and one row updates all channels in a single
+branchless loop, which the compiler vectorizes. The loop is compiled for
+AVX-512, AVX2 and generic x86-64 (target_clones), the best one is selected at
+load time.
+
+Alarms are rare, so the differences of a row are checked first: if no lane
+is waiting and every difference is below its threshold, a much shorter loop
+only amends diffavg and ends patterns (multichannel_quiet_tick()), other rows
+are evaluated by the complete state machine. The single-channel detector has
+no such prescan: its loop is bound by the latency of the diffavg recurrence,
+which a prescan does not shorten (measured, no gain).
+
+Results are bit-exact with AlarmNoiseRejectDetector for every channel: the
+same float operations in the same order are used (no FMA contraction, which
+is off for -std=c++17).
+
+Usage:
+
+MultiChannelDetector detector(channels, params);
+...
+if (detector.push(t_usec, values)) {      // true if any channel has an event
+	for (size_t ch = 0; ch < channels; ch++)
+		if (detector.event(ch) & CHANNEL_EVENT_ALARM) ...
+}
+
+With the same parameters for all channels, sampling (SAMPLE_EACH) is up to
+the caller, like for AlarmNoiseRejectDetector::process().
+
+Each channel (lane) may also have its own parameters, including sampling,
+e.g. to evaluate many parameter sets on one input in lockstep (see fp_sweep.h):
+
+MultiChannelDetector detector(param_sets);
+...
+detector.push_all(t_usec, value);       // the same value to all lanes
+ */
+
+#ifndef FP_MULTICHANNEL_H_
+#define FP_MULTICHANNEL_H_
+
+#include <vector>
+#include <algorithm>
+#include <cstdint>
+#include <cstdlib>
+
+#include "fp_detector.h"
+
+// event flags of a channel after push()
+#define CHANNEL_EVENT_ALARM 1          // alarm raised, pattern started
+#define CHANNEL_EVENT_PATTERN_END 2    // pattern of the channel ended (before this row)
+
+// channel arrays are padded to multiple of this (one AVX-512 register of floats)
+#define CHANNEL_LANES 16
+
+
+// per-channel state and parameters as structure of arrays
+struct ChannelArrays {
+	// parameters
+	float* mult;             // multiplicator_to_detect
+	float* n_minus_1;        // n_amend_avgdiff - 1
+	float* n;                // n_amend_avgdiff
+	int32_t* npoints;        // number_of_points_to_alarm
+	int64_t* wait_usec;      // wait_state_usec
+	int64_t* pattern_usec;   // pattern_state_usec
+	int32_t* sample_each;    // sample_each
+
+	// state
+	int32_t* cursample;
+	int32_t* started;
+	float* diffavg;
+	float* lastval;
+	int32_t* numthresholded;
+	int32_t* patternid;
+	int64_t* alarmraisetime;
+	int64_t* patternraisetime;
+	int32_t* isalarm;
+	int32_t* iswait;
+	int32_t* ispattern;
+
+	// results of the last row
+	float* diff;
+	int32_t* event;
+
+	// absolute differences of the last row, see multichannel_quiet_tick()
+	float* absdiff;
+};
+
+// evaluates one row of all lanes, returns nonzero if any lane has an event
+__attribute__((target_clones("avx512f", "avx2", "default")))
+inline int multichannel_tick(const ChannelArrays& a, size_t lanes, int64_t t, const float* values) {
+	// local restrict copies let the compiler vectorize
+	const float* __restrict mult = a.mult;
+	const float* __restrict n_minus_1 = a.n_minus_1;
+	const float* __restrict n = a.n;
+	const int32_t* __restrict npoints = a.npoints;
+	const int64_t* __restrict wait_usec = a.wait_usec;
+	const int64_t* __restrict pattern_usec = a.pattern_usec;
+	const float* __restrict v = values;
+	float* __restrict diffavg = a.diffavg;
+	float* __restrict lastval = a.lastval;
+	int32_t* __restrict numthresholded = a.numthresholded;
+	int32_t* __restrict patternid = a.patternid;
+	int64_t* __restrict alarmraisetime = a.alarmraisetime;
+	int64_t* __restrict patternraisetime = a.patternraisetime;
+	int32_t* __restrict isalarm = a.isalarm;
+	int32_t* __restrict iswait = a.iswait;
+	int32_t* __restrict ispattern = a.ispattern;
+	float* __restrict diffout = a.diff;
+	int32_t* __restrict event = a.event;
+
+	const int32_t* __restrict sample_each = a.sample_each;
+	int32_t* __restrict cursample = a.cursample;
+	int32_t* __restrict started = a.started;
+
+	int any = 0;
+	for (size_t i = 0; i < lanes; i++) {
+		// sampling, lanes not taking this sample keep their state
+		int32_t c = cursample[i] - 1;
+		int32_t take = c <= 0;
+		cursample[i] = take ? sample_each[i] : c;
+
+		// first sample of the lane is compared with itself
+		float last = started[i] ? lastval[i] : v[i];
+		started[i] |= take;
+		float diffnoabs = v[i] - last;
+		float diff = abs(static_cast<int>(diffnoabs));
+		lastval[i] = take ? v[i] : lastval[i];
+
+		// pattern evaluation
+		int32_t pattern_end = take & ispattern[i] & (t - patternraisetime[i] > pattern_usec[i]);
+
+		// wait state or threshold evaluation
+		int32_t w = iswait[i];
+		int32_t wait_end = w & (t - alarmraisetime[i] > wait_usec[i]);
+		int32_t below = diff < mult[i] * diffavg[i];
+		int32_t nth = numthresholded[i] - 1;
+		int32_t raise = take & !w & !below & (nth == 0);
+		nth = (below | raise) ? npoints[i] : nth;
+		numthresholded[i] = (w | !take) ? numthresholded[i] : nth;
+
+		isalarm[i] = take ? raise : isalarm[i];
+		int32_t wait = take ? (w ? !wait_end : raise) : w;
+		iswait[i] = wait;
+		alarmraisetime[i] = raise ? t : alarmraisetime[i];
+
+		// pattern starts
+		patternid[i] += raise;
+		ispattern[i] = raise | (ispattern[i] & !pattern_end);
+		patternraisetime[i] = raise ? t : patternraisetime[i];
+
+		// amend diffavg if not waiting and no detection in progress
+		int32_t amend = take & !wait & (numthresholded[i] == npoints[i]);
+		float amended = (diffavg[i] * n_minus_1[i] + diff) / n[i];
+		diffavg[i] = amend ? amended : diffavg[i];
+
+		diffout[i] = diffnoabs;
+		int32_t ev = raise | (pattern_end << 1);
+		event[i] = ev;
+		any |= ev;
+	}
+	return any;
+}
+
+
+// evaluates one row of all lanes if it is quiet: all lanes started, none waiting and
+// every difference below its threshold, so only diffavg, last values and pattern ends
+// change (as by multichannel_tick()); returns -1 and changes no state otherwise
+// (lanes must take every sample, sample_each 1)
+__attribute__((target_clones("avx512f", "avx2", "default")))
+inline int multichannel_quiet_tick(const ChannelArrays& a, size_t lanes, int64_t t, const float* values) {
+	const float* __restrict mult = a.mult;
+	const float* __restrict n_minus_1 = a.n_minus_1;
+	const float* __restrict n = a.n;
+	const int32_t* __restrict npoints = a.npoints;
+	const int64_t* __restrict pattern_usec = a.pattern_usec;
+	const float* __restrict v = values;
+	const int32_t* __restrict started = a.started;
+	const int32_t* __restrict iswait = a.iswait;
+	const int64_t* __restrict patternraisetime = a.patternraisetime;
+	float* __restrict diffavg = a.diffavg;
+	float* __restrict lastval = a.lastval;
+	int32_t* __restrict numthresholded = a.numthresholded;
+	int32_t* __restrict isalarm = a.isalarm;
+	int32_t* __restrict ispattern = a.ispattern;
+	float* __restrict diffout = a.diff;
+	float* __restrict absdiff = a.absdiff;
+	int32_t* __restrict event = a.event;
+
+	// differences and check of all lanes first (only results are written)
+	int32_t quiet = 1;
+	for (size_t i = 0; i < lanes; i++) {
+		float diffnoabs = v[i] - lastval[i];
+		float diff = abs(static_cast<int>(diffnoabs));
+		diffout[i] = diffnoabs;
+		absdiff[i] = diff;
+		quiet &= started[i] & !iswait[i] & (diff < mult[i] * diffavg[i]);
+	}
+	if (!quiet)
+		return -1;
+
+	int any = 0;
+	for (size_t i = 0; i < lanes; i++) {
+		lastval[i] = v[i];
+		int32_t pattern_end = ispattern[i] & (t - patternraisetime[i] > pattern_usec[i]);
+		numthresholded[i] = npoints[i];
+		isalarm[i] = 0;
+		ispattern[i] &= !pattern_end;
+		diffavg[i] = (diffavg[i] * n_minus_1[i] + absdiff[i]) / n[i];
+		int32_t ev = pattern_end << 1;
+		event[i] = ev;
+		any |= ev;
+	}
+	return any;
+}
+
+
+class MultiChannelDetector {
+public:
+	// channels with the same parameters, sampling is left to the caller
+	MultiChannelDetector(size_t channels, const AlarmNoiseRejectParams& params) {
+		AlarmNoiseRejectParams lane = params;
+		lane.sample_each = 1;
+		init(std::vector<AlarmNoiseRejectParams>(channels, lane));
+	}
+
+	// one lane per parameter set, each with its own sampling
+	explicit MultiChannelDetector(const std::vector<AlarmNoiseRejectParams>& lane_params) {
+		init(lane_params);
+	}
+
+	MultiChannelDetector(const MultiChannelDetector&) = delete;
+	MultiChannelDetector& operator=(const MultiChannelDetector&) = delete;
+
+	// evaluates one row, values[0..channels-1], true if any channel has an event
+	bool push(int64_t t_usec, const float* row) {
+		std::copy(row, row + channels, values.begin());
+		return tick(t_usec) != 0;
+	}
+
+	// evaluates the same value in all lanes, true if any lane has an event
+	bool push_all(int64_t t_usec, float value) {
+		std::fill(values.begin(), values.begin() + channels, value);
+		return tick(t_usec) != 0;
+	}
+
+	// input row not evaluated (e.g. invalid), only counts for sampling
+	void skip() {
+		for (size_t i = 0; i < lanes; i++)
+			a.cursample[i] = (a.cursample[i] <= 1) ? a.sample_each[i] : a.cursample[i] - 1;
+	}
+
+	size_t size() const { return channels; }
+
+	// results of the last row for channel ch
+	int event(size_t ch) const { return a.event[ch]; }
+	float diff(size_t ch) const { return a.diff[ch]; }
+	float diffavg(size_t ch) const { return a.diffavg[ch]; }
+	float value(size_t ch) const { return values[ch]; }
+	int patternid(size_t ch) const { return a.patternid[ch]; }
+
+	bool isdetect(size_t ch) const { return a.numthresholded[ch] != a.npoints[ch]; }
+	bool iswait(size_t ch) const { return a.iswait[ch]; }
+	bool ispattern(size_t ch) const { return a.ispattern[ch]; }
+
+private:
+	// rows are quiet (see multichannel_quiet_tick()) most of the time
+	int tick(int64_t t_usec) {
+		if (every_sample) {
+			int events = multichannel_quiet_tick(a, lanes, t_usec, values.data());
+			if (events >= 0)
+				return events;
+		}
+		return multichannel_tick(a, lanes, t_usec, values.data());
+	}
+
+	void init(const std::vector<AlarmNoiseRejectParams>& lane_params) {
+		channels = lane_params.size();
+		lanes = (channels + CHANNEL_LANES - 1) / CHANNEL_LANES * CHANNEL_LANES;
+		values.assign(lanes, 0);
+
+		f32.assign(7 * lanes, 0);
+		i32.assign(10 * lanes, 0);
+		i64.assign(4 * lanes, 0);
+
+		a.mult = &f32[0]; a.n_minus_1 = &f32[lanes]; a.n = &f32[2 * lanes];
+		a.diffavg = &f32[3 * lanes]; a.lastval = &f32[4 * lanes]; a.diff = &f32[5 * lanes];
+		a.absdiff = &f32[6 * lanes];
+		a.npoints = &i32[0]; a.numthresholded = &i32[lanes]; a.patternid = &i32[2 * lanes];
+		a.isalarm = &i32[3 * lanes]; a.iswait = &i32[4 * lanes]; a.ispattern = &i32[5 * lanes];
+		a.event = &i32[6 * lanes]; a.sample_each = &i32[7 * lanes]; a.cursample = &i32[8 * lanes];
+		a.started = &i32[9 * lanes];
+		a.wait_usec = &i64[0]; a.pattern_usec = &i64[lanes];
+		a.alarmraisetime = &i64[2 * lanes]; a.patternraisetime = &i64[3 * lanes];
+
+		for (size_t i = 0; i < lanes; i++) {
+			// padding lanes run with parameters of the first lane, results are not used
+			const AlarmNoiseRejectParams& p = lane_params[i < channels ? i : 0];
+			a.mult[i] = p.multiplicator_to_detect;
+			a.n_minus_1[i] = p.n_amend_avgdiff - 1;
+			a.n[i] = p.n_amend_avgdiff;
+			a.npoints[i] = p.number_of_points_to_alarm;
+			a.wait_usec[i] = p.wait_state_usec;
+			a.pattern_usec[i] = p.pattern_state_usec;
+			a.sample_each[i] = p.sample_each;
+			a.cursample[i] = p.sample_each;
+			a.diffavg[i] = p.initial_avg_diff;
+			a.numthresholded[i] = p.number_of_points_to_alarm;
+
+			// padding lanes keep their diffavg: amended as (diffavg * 1 + 0) / 1 with their zero
+			// differences, else it decays into subnormal floats, which are very slow to compute
+			if (i >= channels) {
+				a.n_minus_1[i] = 1;
+				a.n[i] = 1;
+			}
+		}
+		every_sample = std::all_of(lane_params.begin(), lane_params.end(),
+			[](const AlarmNoiseRejectParams& p) { return p.sample_each == 1; });
+	}
+
+	size_t channels;
+	size_t lanes;
+	bool every_sample;   // no lane samples, quiet rows may be evaluated by the short path
+
+	// current row, padded to lanes
+	std::vector<float> values;
+
+	// storage of the arrays
+	std::vector<float> f32;
+	std::vector<int32_t> i32;
+	std::vector<int64_t> i64;
+	ChannelArrays a;
+};
+
+#endif /* FP_MULTICHANNEL_H_ */
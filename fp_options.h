@@ -0,0 +1,331 @@
+//============================================================================
+// Name        : fp_options.h
+// Description : Command line options of fp_generate_patterns
+//============================================================================
+
+/*
+Program is called with either none or all seven integer (positional) arguments,
+options starting with -- may be placed anywhere:
+
+--utc-offset SEC   offset of input timestamps local time to UTC in seconds (default 0)
+--flush POLICY     when output is written: line, block (default), alarm, exit (see fp_writer.h)
+--channels N       number of values (channels) in each input row, default 1
+                   for more channels, alarm and pattern end events of each channel are output
+--input-format F   csv (default): timestamp;value[;value...] lines
+                   frames: binary records of int64 timestamp (usec) and N float values
+--pipeline         (no value) read+parse, detection and output formatting run on
+                   separate threads (one channel only)
+--pin-cpus LIST    comma separated CPUs for the pipeline stages in the order
+                   parse, detect, output, e.g. 0,2,4 (-1 for no pinning)
+--sweep FILE       evaluates all parameter sets of FILE (see fp_sweep.h) in one pass
+                   and outputs a summary per set instead of the seven arguments
+--sweep-patterns FILE  with --sweep, writes set;patternid;timestamp of every pattern to FILE
+--output MODE      samples (default): one line per sample
+                   events: alarms and pattern ends only (see fp_events.h), one channel
+--heartbeat USEC   with --output events, outputs current state every USEC of input time
+--alarm-fd FD      writes alarm events (see fp_events.h) to descriptor FD immediately,
+                   by one write() each, regardless of --flush, one channel
+--patterns-out FILE  writes waveform of every pattern to FILE (see fp_patterns.h), one channel
+--patterns-format F  csv (default) or binary records in --patterns-out
+--pattern-pre N    samples before the alarm in pattern records, default 64
+--pattern-post N   samples from the alarm on in pattern records, default 0: while
+                   the pattern lasts (see PATTERN_STATE_USEC)
+--convert-to FILE  converts input (csv, --channels values per row) into binary capture
+                   FILE (see fp_capture.h) instead of processing it
+--value-type T     value column type of --convert-to: float32 (default) or int32
+--capture FILE     processes capture FILE instead of stdin, number of channels
+                   is taken from the file; sampling counts rows of the capture
+--embed-checkpoints  (no value) with --convert-to (one channel), embeds detector
+                   states every --checkpoint-every rows into the capture (see
+                   fp_checkpoint.h); with --capture, replaces those of the capture
+                   instead of processing it
+--threads N        evaluates one channel --capture in segments on N threads (see
+                   fp_parallel.h), sample output only, default 1
+--warmup N         with --threads, rows evaluated before each segment when the
+                   capture has no embedded checkpoints of the parameters, default 100000
+--shm NAME         reads binary samples from shared-memory ring NAME (see fp_shm.h)
+                   instead of stdin, waits for the producer to create it
+--shm-wait MODE    futex (default): sleep while the ring is empty, poll: busy wait
+--listen ADDRESS   server mode: accepts timestamp;value streams on unix:PATH or
+                   tcp:HOST:PORT (see fp_server.h), each with its own detector,
+                   and outputs stream;event... rows (see fp_events.h) of all streams
+--server-threads N  number of threads serving --listen connections, default 1
+--arithmetic A     float (default) or fixed: integer values and fixed-point diffavg,
+                   bit-exact on every platform (see fp_detector.h), one channel;
+                   input values out of the int32 range or not finite are skipped
+--calibrate FILE   calibration instead of processing: computes noise profile (see
+                   fp_profile.h) of the input (stdin or --capture) and writes it to FILE
+--calibrate-samples N  calibrates on the first N (sampled) samples, default 0: all
+--calibrate-channel CH  channel of --capture to calibrate, default 0
+--profile FILE     takes INITIAL_AVG_DIFF from the noise profile FILE written
+                   by --calibrate (instead of the argument or default)
+--checkpoint FILE  saves detector state, lineid and input/output offsets to FILE
+                   (see fp_checkpoint.h) every --checkpoint-every samples and at the end,
+                   one channel sample output from stdin only
+--checkpoint-every N  samples between checkpoints (rows with --embed-checkpoints),
+                   default 1000000
+--resume           (no value) continues from --checkpoint FILE if it exists: skips
+                   the consumed input, truncates the output file (stdout appended
+                   to by >>) to the checkpoint and outputs no header
+--stats-interval SEC  prints counters and throughput (see fp_stats.h) to stderr every
+                   SEC seconds and at the end, default 0: on SIGUSR1 only
+--latency N        tracks read-to-emit latency of every N-th output row and of all
+                   alarm rows (see fp_histogram.h), printed to stderr at the end
+                   and on SIGUSR1, one channel, default 0: off
+ */
+
+#ifndef FP_OPTIONS_H_
+#define FP_OPTIONS_H_
+
+#include <iostream>
+#include <string>
+#include <vector>
+#include <cstdlib>
+#include <cstring>
+#include <fcntl.h>
+
+#include "fp_capture.h"
+#include "fp_patterns.h"
+#include "fp_shm.h"
+#include "fp_writer.h"
+
+struct ProgramOptions {
+	long utc_offset_sec = 0;
+	FlushPolicy flush_policy = FLUSH_BLOCK;
+	long channels = 1;
+	bool binary_frames = false;
+	bool pipeline = false;
+	std::vector<int> pin_cpus;
+	const char* sweep_file = nullptr;
+	const char* sweep_patterns_file = nullptr;
+	bool events_output = false;
+	long heartbeat_usec = 0;
+	long alarm_fd = -1;
+	const char* shm_name = nullptr;
+	ShmWait shm_wait = SHM_WAIT_FUTEX;
+	const char* listen_address = nullptr;
+	long server_threads = 1;
+	const char* patterns_file = nullptr;
+	bool patterns_binary = false;
+	long pattern_pre = 64;
+	long pattern_post = 0;
+	const char* convert_file = nullptr;
+	uint32_t capture_value_type = CAPTURE_FLOAT32;
+	const char* capture_file = nullptr;
+	bool embed_checkpoints = false;
+	long threads = 1;
+	long warmup = 100000;
+	bool fixed_point = false;
+	const char* calibrate_file = nullptr;
+	long calibrate_samples = 0;
+	long calibrate_channel = 0;
+	const char* profile_file = nullptr;
+	const char* checkpoint_file = nullptr;
+	long checkpoint_every = 1000000;
+	bool resume = false;
+	double stats_interval_sec = 0;
+	long latency_every = 0;
+
+	// remaining (positional) arguments
+	std::vector<char*> positional;
+};
+
+
+// prints error about option value, returns false
+inline bool invalid_option_value(const char* name, const char* value) {
+	std::cerr << "Invalid value of option " << name << ": " << value << std::endl;
+	return false;
+}
+
+// parses integer option value, false if not a whole number
+inline bool parse_option_long(const char* name, const char* value, long& out) {
+	char* endp;
+	out = strtol(value, &endp, 10);
+	if (*value == '\0' || *endp != '\0')
+		return invalid_option_value(name, value);
+	return true;
+}
+
+// parses comma separated list of integers
+inline bool parse_option_list(const char* name, const char* value, std::vector<int>& out) {
+	out.clear();
+	const char* p = value;
+	for (;;) {
+		char* endp;
+		long v = strtol(p, &endp, 10);
+		if (endp == p || (*endp != ',' && *endp != '\0'))
+			return invalid_option_value(name, value);
+		out.push_back(v);
+		if (*endp == '\0')
+			return true;
+		p = endp + 1;
+	}
+}
+
+// splits arguments to options and positional arguments, false on error
+inline bool parse_options(int argc, char* argv[], ProgramOptions& opts) {
+	for (int i = 1; i < argc; i++) {
+		const char* arg = argv[i];
+		if (strncmp(arg, "--", 2) != 0) {
+			opts.positional.push_back(argv[i]);
+			continue;
+		}
+
+		// options without value
+		if (!strcmp(arg, "--pipeline")) {
+			opts.pipeline = true;
+			continue;
+		}
+		if (!strcmp(arg, "--resume")) {
+			opts.resume = true;
+			continue;
+		}
+		if (!strcmp(arg, "--embed-checkpoints")) {
+			opts.embed_checkpoints = true;
+			continue;
+		}
+
+		// all other options take a value
+		if (i + 1 >= argc) {
+			std::cerr << "Missing value of option " << arg << std::endl;
+			return false;
+		}
+		const char* value = argv[++i];
+
+		if (!strcmp(arg, "--utc-offset")) {
+			if (!parse_option_long(arg, value, opts.utc_offset_sec))
+				return false;
+		} else if (!strcmp(arg, "--flush")) {
+			if (!parse_flush_policy(value, opts.flush_policy))
+				return invalid_option_value(arg, value);
+		} else if (!strcmp(arg, "--channels")) {
+			if (!parse_option_long(arg, value, opts.channels))
+				return false;
+			if (opts.channels < 1)
+				return invalid_option_value(arg, value);
+		} else if (!strcmp(arg, "--input-format")) {
+			if (!strcmp(value, "csv"))
+				opts.binary_frames = false;
+			else if (!strcmp(value, "frames"))
+				opts.binary_frames = true;
+			else
+				return invalid_option_value(arg, value);
+		} else if (!strcmp(arg, "--pin-cpus")) {
+			if (!parse_option_list(arg, value, opts.pin_cpus))
+				return false;
+		} else if (!strcmp(arg, "--sweep")) {
+			opts.sweep_file = value;
+		} else if (!strcmp(arg, "--sweep-patterns")) {
+			opts.sweep_patterns_file = value;
+		} else if (!strcmp(arg, "--output")) {
+			if (!strcmp(value, "samples"))
+				opts.events_output = false;
+			else if (!strcmp(value, "events"))
+				opts.events_output = true;
+			else
+				return invalid_option_value(arg, value);
+		} else if (!strcmp(arg, "--heartbeat")) {
+			if (!parse_option_long(arg, value, opts.heartbeat_usec))
+				return false;
+			if (opts.heartbeat_usec < 0)
+				return invalid_option_value(arg, value);
+		} else if (!strcmp(arg, "--alarm-fd")) {
+			if (!parse_option_long(arg, value, opts.alarm_fd))
+				return false;
+			if (opts.alarm_fd < 0 || fcntl(opts.alarm_fd, F_GETFD) < 0)
+				return invalid_option_value(arg, value);
+		} else if (!strcmp(arg, "--shm")) {
+			opts.shm_name = value;
+		} else if (!strcmp(arg, "--shm-wait")) {
+			if (!strcmp(value, "futex"))
+				opts.shm_wait = SHM_WAIT_FUTEX;
+			else if (!strcmp(value, "poll"))
+				opts.shm_wait = SHM_WAIT_POLL;
+			else
+				return invalid_option_value(arg, value);
+		} else if (!strcmp(arg, "--listen")) {
+			opts.listen_address = value;
+		} else if (!strcmp(arg, "--server-threads")) {
+			if (!parse_option_long(arg, value, opts.server_threads))
+				return false;
+			if (opts.server_threads < 1 || opts.server_threads > 1024)
+				return invalid_option_value(arg, value);
+		} else if (!strcmp(arg, "--patterns-out")) {
+			opts.patterns_file = value;
+		} else if (!strcmp(arg, "--patterns-format")) {
+			if (!strcmp(value, "csv"))
+				opts.patterns_binary = false;
+			else if (!strcmp(value, "binary"))
+				opts.patterns_binary = true;
+			else
+				return invalid_option_value(arg, value);
+		} else if (!strcmp(arg, "--pattern-pre") || !strcmp(arg, "--pattern-post")) {
+			long& n = strcmp(arg, "--pattern-pre") ? opts.pattern_post : opts.pattern_pre;
+			if (!parse_option_long(arg, value, n))
+				return false;
+			if (n < 0 || n > PATTERN_MAX_SAMPLES)
+				return invalid_option_value(arg, value);
+		} else if (!strcmp(arg, "--convert-to")) {
+			opts.convert_file = value;
+		} else if (!strcmp(arg, "--value-type")) {
+			if (!strcmp(value, "float32"))
+				opts.capture_value_type = CAPTURE_FLOAT32;
+			else if (!strcmp(value, "int32"))
+				opts.capture_value_type = CAPTURE_INT32;
+			else
+				return invalid_option_value(arg, value);
+		} else if (!strcmp(arg, "--capture")) {
+			opts.capture_file = value;
+		} else if (!strcmp(arg, "--threads")) {
+			if (!parse_option_long(arg, value, opts.threads))
+				return false;
+			if (opts.threads < 1 || opts.threads > 1024)
+				return invalid_option_value(arg, value);
+		} else if (!strcmp(arg, "--warmup")) {
+			if (!parse_option_long(arg, value, opts.warmup))
+				return false;
+			if (opts.warmup < 0)
+				return invalid_option_value(arg, value);
+		} else if (!strcmp(arg, "--arithmetic")) {
+			if (!strcmp(value, "float"))
+				opts.fixed_point = false;
+			else if (!strcmp(value, "fixed"))
+				opts.fixed_point = true;
+			else
+				return invalid_option_value(arg, value);
+		} else if (!strcmp(arg, "--calibrate")) {
+			opts.calibrate_file = value;
+		} else if (!strcmp(arg, "--calibrate-samples") || !strcmp(arg, "--calibrate-channel")) {
+			long& n = strcmp(arg, "--calibrate-samples") ? opts.calibrate_channel : opts.calibrate_samples;
+			if (!parse_option_long(arg, value, n))
+				return false;
+			if (n < 0)
+				return invalid_option_value(arg, value);
+		} else if (!strcmp(arg, "--profile")) {
+			opts.profile_file = value;
+		} else if (!strcmp(arg, "--latency")) {
+			if (!parse_option_long(arg, value, opts.latency_every))
+				return false;
+			if (opts.latency_every < 0)
+				return invalid_option_value(arg, value);
+		} else if (!strcmp(arg, "--checkpoint")) {
+			opts.checkpoint_file = value;
+		} else if (!strcmp(arg, "--checkpoint-every")) {
+			if (!parse_option_long(arg, value, opts.checkpoint_every))
+				return false;
+			if (opts.checkpoint_every < 1)
+				return invalid_option_value(arg, value);
+		} else if (!strcmp(arg, "--stats-interval")) {
+			char* endp;
+			opts.stats_interval_sec = strtod(value, &endp);
+			if (*value == '\0' || *endp != '\0' || !(opts.stats_interval_sec >= 0))
+				return invalid_option_value(arg, value);
+		} else {
+			std::cerr << "Unknown option: " << arg << std::endl;
+			return false;
+		}
+	}
+	return true;
+}
+
+#endif /* FP_OPTIONS_H_ */
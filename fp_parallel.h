@@ -0,0 +1,342 @@
+//============================================================================
+// Name        : fp_parallel.h
+// Description : Parallel evaluation of a capture in segments from checkpoints
+//============================================================================
+
+/*
+diffavg is frozen while waiting or while detection is in progress, so the
+state before a sample depends on all samples before it and one stream is
+evaluated sequentially. A capture (see fp_capture.h) is evaluated in parallel
+by splitting it at checkpoints, states of the detector before given rows (see
+CaptureCheckpoints of fp_checkpoint.h): each segment starts from the state of
+its checkpoint and its output is exactly the same as in one sequential run.
+
+ParallelSegments segments(threads);
+segments.run(count, out,
+	[&](size_t k, OutputWriter& segment_out) { ... },   // on a pool thread
+	[&](size_t k) { ... });                              // after output of k is appended
+if (... !segments.error().empty())
+
+Each segment is written to its own temporary file, the files are appended to
+the output in order of segments as soon as they are complete; at most
+PARALLEL_WINDOW_PER_THREAD segments per thread are ahead of the last appended
+one, which bounds the temporary space taken.
+
+Checkpoints are either embedded into the capture for given parameters
+(record_checkpoints(), e.g. --convert-to with --embed-checkpoints), or, for
+parameters without embedded checkpoints, found speculatively
+(speculate_checkpoints()): each segment is evaluated from the initial state
+after warmup rows before it, which gives diffavg converged to the noise of
+those rows instead of the real one. Then, segment by segment, the guessed
+state is compared with the exact one at the end of the previous segment; if it
+differs, the segment is evaluated again from the exact state until the states
+meet at one of SPECULATIVE_SYNC_POINTS states kept per segment (float
+diffavg of both meets exactly after some thousands of samples of noise), from
+then on the speculative run is exact (patternid shifted by the patterns before
+it). Only boundary regions are evaluated sequentially, and without output.
+ */
+
+#ifndef FP_PARALLEL_H_
+#define FP_PARALLEL_H_
+
+#include <string>
+#include <vector>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <atomic>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <cerrno>
+
+#include "fp_capture.h"
+#include "fp_checkpoint.h"
+#include "fp_detector.h"
+#include "fp_writer.h"
+
+// Segments per thread a capture is split into (better balance of unequal segments)
+#define PARALLEL_SEGMENTS_PER_THREAD 4
+
+// Segments per thread evaluated ahead of the one being appended to the output
+#define PARALLEL_WINDOW_PER_THREAD 2
+
+// States kept per speculative segment to find where it meets the exact run
+#define SPECULATIVE_SYNC_POINTS 1024
+
+
+// evaluates rows [first, last) of channel 0 without output, returns number of evaluated samples
+template <class Detector>
+inline uint64_t advance_capture(const CaptureFile& capture, Detector& detector, uint64_t first, uint64_t last) {
+	int64_t t[DETECTOR_BLOCK_SIZE];
+	float v[DETECTOR_BLOCK_SIZE];
+	int32_t iv[DETECTOR_BLOCK_SIZE];
+	AlarmNoiseRejectResult r[DETECTOR_BLOCK_SIZE];
+	const int64_t* ts = capture.timestamps();
+	uint64_t samples = 0;
+
+	// int32 columns go to the fixed-point detector as they are, as by the sequential processing
+	bool int_values = detector.params().fixed_point && !capture.is_float();
+
+	uint64_t i = first;
+	while (i < last) {
+		size_t n = 0;
+		if (detector.params().sample_each == 1) {
+			n = last - i < DETECTOR_BLOCK_SIZE ? last - i : DETECTOR_BLOCK_SIZE;
+			if (int_values)
+				detector.process(ts + i, capture.int_column(0) + i, n, r);
+			else {
+				capture.values(0, i, n, v);
+				detector.process(ts + i, v, n, r);
+			}
+			i += n;
+		} else {
+			for (; n < DETECTOR_BLOCK_SIZE && i < last; i++) {
+				if (!detector.sample())
+					continue;
+				t[n] = ts[i];
+				if (int_values)
+					iv[n] = capture.int_column(0)[i];
+				else
+					v[n] = capture.value(0, i);
+				n++;
+			}
+			if (int_values)
+				detector.process(t, iv, n, r);
+			else
+				detector.process(t, v, n, r);
+		}
+		samples += n;
+	}
+	return samples;
+}
+
+// true if evaluation goes on the same from both states except for patternid
+// (times of ended wait and pattern states do not matter)
+inline bool same_course(const AlarmNoiseRejectState& a, const AlarmNoiseRejectState& b) {
+	return a.diffavg == b.diffavg && a.lastval == b.lastval &&
+		a.diffavg_q == b.diffavg_q && a.lastval_i == b.lastval_i &&
+		a.numthresholded == b.numthresholded && a.cursample == b.cursample &&
+		a.isalarm == b.isalarm && a.iswait == b.iswait && a.ispattern == b.ispattern &&
+		a.started == b.started &&
+		(!a.iswait || a.alarmraisetime == b.alarmraisetime) &&
+		(!a.ispattern || a.patternraisetime == b.patternraisetime);
+}
+
+// states of the detector (in its initial state) before every every-th row of the capture
+template <class Detector>
+inline CaptureCheckpoints record_checkpoints(const CaptureFile& capture, Detector detector, uint64_t every) {
+	CaptureCheckpoints checkpoints;
+	checkpoints.params = detector.params();
+	int64_t lineid = 0;
+	for (uint64_t row = every; row < capture.size(); row += every) {
+		lineid += advance_capture(capture, detector, row - every, row);
+		checkpoints.list.push_back(CaptureCheckpoint{row, lineid, detector.state()});
+	}
+	return checkpoints;
+}
+
+// first rows of segments (but the first one) when size rows are split into count segments,
+// multiples of sample_each (so that a detector in the initial state samples the same rows)
+inline std::vector<uint64_t> segment_rows(uint64_t size, size_t count, int sample_each) {
+	std::vector<uint64_t> rows;
+	for (size_t k = 1; k < count; k++) {
+		uint64_t row = size * k / count / sample_each * sample_each;
+		if (row > (rows.empty() ? 0 : rows.back()) && row < size)
+			rows.push_back(row);
+	}
+	return rows;
+}
+
+// runs f(k) for k in [0, count) on threads
+template <class F>
+inline void parallel_for(size_t count, int threads, F f) {
+	std::atomic<size_t> next{0};
+	std::vector<std::thread> pool;
+	for (int i = 0; i < threads; i++) {
+		pool.emplace_back([&] {
+			for (size_t k; (k = next.fetch_add(1)) < count;)
+				f(k);
+		});
+	}
+	for (std::thread& thread : pool)
+		thread.join();
+}
+
+// exact states of the detector (in its initial state) before rows (of segment_rows()), found
+// by speculative evaluation of the segments from warmup rows before them on threads
+template <class Detector>
+inline CaptureCheckpoints speculate_checkpoints(const CaptureFile& capture, const Detector& initial,
+		const std::vector<uint64_t>& rows, uint64_t warmup, int threads) {
+
+	// state after each sync row of a segment, the last one is its end
+	struct Speculation {
+		AlarmNoiseRejectState start;
+		std::vector<uint64_t> sync_rows;
+		std::vector<AlarmNoiseRejectState> sync_states;
+	};
+	int sample_each = initial.params().sample_each;
+	size_t count = rows.size() + 1;
+	std::vector<Speculation> spec(count);
+
+	parallel_for(count, threads, [&](size_t k) {
+		uint64_t first = k ? rows[k - 1] : 0;
+		uint64_t last = k < rows.size() ? rows[k] : capture.size();
+		uint64_t from = first > warmup ? (first - warmup) / sample_each * sample_each : 0;
+		uint64_t step = (last - first) / SPECULATIVE_SYNC_POINTS + 1;
+
+		Detector detector = initial;
+		advance_capture(capture, detector, from, first);
+		Speculation& s = spec[k];
+		s.start = detector.state();
+		for (uint64_t row = first; row < last;) {
+			uint64_t next = last - row > step ? row + step : last;
+			advance_capture(capture, detector, row, next);
+			s.sync_rows.push_back(next);
+			s.sync_states.push_back(detector.state());
+			row = next;
+		}
+	});
+
+	// the first segment starts with the initial state, so it is exact; the exact state
+	// of the end of each one is where the next one starts
+	CaptureCheckpoints checkpoints;
+	checkpoints.params = initial.params();
+	AlarmNoiseRejectState exact = spec[0].sync_states.back();
+	for (size_t k = 1; k < count; k++) {
+		const Speculation& s = spec[k];
+		checkpoints.list.push_back(CaptureCheckpoint{rows[k - 1], static_cast<int64_t>(rows[k - 1] / sample_each), exact});
+
+		// patternid of the speculative run is shifted by patterns before the segment
+		int shift = exact.patternid - s.start.patternid;
+		bool met = same_course(exact, s.start);
+		if (!met) {
+			Detector detector = initial;
+			detector.set_state(exact);
+			uint64_t row = rows[k - 1];
+			for (size_t j = 0; j < s.sync_rows.size() && !met; j++) {
+				advance_capture(capture, detector, row, s.sync_rows[j]);
+				row = s.sync_rows[j];
+				shift = detector.state().patternid - s.sync_states[j].patternid;
+				met = same_course(detector.state(), s.sync_states[j]);
+			}
+			exact = detector.state();
+		}
+		if (met) {
+			exact = s.sync_states.back();
+			exact.patternid += shift;
+		}
+	}
+	return checkpoints;
+}
+
+
+// evaluation of segments on a pool of threads with output in order of segments
+class ParallelSegments {
+public:
+	explicit ParallelSegments(int threads) : threads(threads) {}
+
+	// evaluate(k, out) writes output of segment k (on a pool thread), appended(k) is
+	// called after it is appended to out; false with error message in error()
+	template <class Evaluate, class Appended>
+	bool run(size_t count, OutputWriter& out, Evaluate evaluate, Appended appended) {
+		files.assign(count, nullptr);
+		done.assign(count, false);
+		next = 0;
+		appended_count = 0;
+		err.clear();
+
+		std::vector<std::thread> pool;
+		for (int i = 0; i < threads; i++)
+			pool.emplace_back([&] { work(count, evaluate); });
+
+		std::vector<char> buf(OUTPUT_BUFFER_SIZE);
+		for (size_t k = 0; k < count; k++) {
+			FILE* file;
+			{
+				std::unique_lock<std::mutex> lock(mutex);
+				changed.wait(lock, [&] { return done[k] || !err.empty(); });
+				if (!err.empty())
+					break;
+				file = files[k];
+			}
+
+			// copy of the segment output
+			rewind(file);
+			size_t n;
+			while ((n = fread(buf.data(), 1, buf.size(), file)) > 0)
+				out.put(std::string_view(buf.data(), n));
+			bool read_error = ferror(file);
+			fclose(file);
+			files[k] = nullptr;
+
+			{
+				std::lock_guard<std::mutex> lock(mutex);
+				if (read_error)
+					err = "temporary file read error";
+				else
+					appended_count = k + 1;
+				changed.notify_all();
+			}
+			if (read_error)
+				break;
+			appended(k);
+		}
+
+		for (std::thread& thread : pool)
+			thread.join();
+		for (FILE* file : files) {
+			if (file)
+				fclose(file);
+		}
+		return err.empty();
+	}
+
+	const std::string& error() const { return err; }
+
+private:
+	template <class Evaluate>
+	void work(size_t count, Evaluate& evaluate) {
+		size_t window = static_cast<size_t>(threads) * PARALLEL_WINDOW_PER_THREAD;
+		for (;;) {
+			size_t k;
+			{
+				std::unique_lock<std::mutex> lock(mutex);
+				changed.wait(lock, [&] { return next >= count || next < appended_count + window || !err.empty(); });
+				if (next >= count || !err.empty())
+					return;
+				k = next++;
+			}
+
+			FILE* file = tmpfile();
+			std::string error;
+			if (!file)
+				error = std::string("cannot create temporary file: ") + strerror(errno);
+			else {
+				OutputWriter segment_out(fileno(file), FLUSH_EXIT);
+				evaluate(k, segment_out);
+				segment_out.flush();
+				if (segment_out.failed())
+					error = std::string("temporary file write error: ") + strerror(segment_out.error());
+			}
+
+			std::lock_guard<std::mutex> lock(mutex);
+			files[k] = file;
+			done[k] = true;
+			if (!error.empty() && err.empty())
+				err = error;
+			changed.notify_all();
+		}
+	}
+
+	int threads;
+	std::vector<FILE*> files;   // output of complete segments not appended yet
+	std::vector<bool> done;
+	size_t next = 0;            // next segment to evaluate
+	size_t appended_count = 0;
+	std::string err;
+	std::mutex mutex;
+	std::condition_variable changed;
+};
+
+#endif /* FP_PARALLEL_H_ */
@@ -0,0 +1,228 @@
+//============================================================================
+// Name        : fp_patterns.h
+// Description : Extraction of pattern waveforms around alarms
+//============================================================================
+
+/*
+Recent samples are kept in a ring buffer of pre_samples entries. When an alarm
+is raised, the pattern record starts with these pre-trigger samples and
+continues with the alarm sample and the following ones, until the pattern ends
+(or post_samples samples are collected, if set). Each pattern is written as
+one record:
+
+csv:    patternid;alarm_lineid;alarm_timestamp;pre;samples;offsets;values
+        offsets are comma separated times of the samples relative to the alarm
+        in usec, values comma separated measured values, pre the number of
+        samples before the alarm (the alarm sample is at index pre)
+
+binary: PatternRecordHeader, int64 t_usec[samples], float values[samples]
+
+Memory is bounded by pre_samples and post_samples (PATTERN_MAX_SAMPLES if the
+pattern length is given by its time only). A pattern in progress at the end
+of input is written by finish() with the samples collected so far.
+ */
+
+#ifndef FP_PATTERNS_H_
+#define FP_PATTERNS_H_
+
+#include <iostream>
+#include <string>
+#include <string_view>
+#include <vector>
+#include <memory>
+#include <cstdint>
+#include <cstring>
+#include <cerrno>
+#include <fcntl.h>
+#include <unistd.h>
+
+#include "fp_detector.h"
+#include "fp_writer.h"
+
+// Maximum number of samples after the alarm in one pattern record
+#define PATTERN_MAX_SAMPLES (1 << 20)
+
+#define PATTERN_RECORD_MAGIC 0x52505046   // "FPPR"
+
+struct PatternRecordHeader {
+	uint32_t magic;          // PATTERN_RECORD_MAGIC
+	int32_t patternid;
+	int64_t alarm_lineid;
+	int64_t alarm_t_usec;
+	uint32_t pre;            // samples before the alarm
+	uint32_t samples;        // all samples of the record
+};
+
+class PatternExtractor {
+public:
+	// post_samples: samples from the alarm on, 0 while the pattern lasts
+	PatternExtractor(OutputWriter& out, bool binary, size_t pre_samples, size_t post_samples = 0) :
+		out(out), binary(binary), pre_samples(pre_samples),
+		post_samples(post_samples ? post_samples : PATTERN_MAX_SAMPLES),
+		ring_t(pre_samples), ring_v(pre_samples) {}
+
+	// header line of csv records
+	void header() {
+		if (!binary) {
+			out.put("patternid;alarm_lineid;alarm_timestamp;pre;samples;offsets;values");
+			out.end_row();
+		}
+	}
+
+	// processes evaluated sample, timestamp() returns its text (called only for alarms)
+	template <class TimestampText>
+	void add(long long lineid, int64_t t_usec, float meas, const AlarmNoiseRejectResult& r, TimestampText timestamp) {
+		// pattern ended or another one started
+		if (patternid && r.patternid != patternid)
+			finish();
+
+		if (r.isalarm) {
+			if (patternid)
+				finish();
+			patternid = r.patternid;
+			alarm_lineid = lineid;
+			alarm_t = t_usec;
+			if (!binary)
+				alarm_timestamp = timestamp();
+
+			// pre-trigger window, oldest first
+			size_t pre = ring_count;
+			for (size_t i = 0; i < pre; i++) {
+				size_t k = (ring_pos + pre_samples - pre + i) % pre_samples;
+				t.push_back(ring_t[k]);
+				v.push_back(ring_v[k]);
+			}
+			pre_count = pre;
+		}
+
+		if (patternid) {
+			t.push_back(t_usec);
+			v.push_back(meas);
+			if (t.size() - pre_count == post_samples)
+				finish();
+		}
+
+		if (pre_samples) {
+			ring_t[ring_pos] = t_usec;
+			ring_v[ring_pos] = meas;
+			ring_pos = (ring_pos + 1) % pre_samples;
+			if (ring_count < pre_samples)
+				ring_count++;
+		}
+	}
+
+	// writes pattern in progress (if any)
+	void finish() {
+		if (!patternid)
+			return;
+		if (binary)
+			write_binary();
+		else
+			write_csv();
+		patternid = 0;
+		t.clear();
+		v.clear();
+	}
+
+private:
+	void write_csv() {
+		out.put_int(patternid); out.put(';');
+		out.put_int(alarm_lineid); out.put(';'); out.put(alarm_timestamp); out.put(';');
+		out.put_int(pre_count); out.put(';'); out.put_int(t.size()); out.put(';');
+		for (size_t i = 0; i < t.size(); i++) {
+			if (i)
+				out.put(',');
+			out.put_int(t[i] - alarm_t);
+		}
+		out.put(';');
+		for (size_t i = 0; i < v.size(); i++) {
+			if (i)
+				out.put(',');
+			out.put_float(v[i]);
+		}
+		out.end_row();
+	}
+
+	void write_binary() {
+		PatternRecordHeader h;
+		h.magic = PATTERN_RECORD_MAGIC;
+		h.patternid = patternid;
+		h.alarm_lineid = alarm_lineid;
+		h.alarm_t_usec = alarm_t;
+		h.pre = pre_count;
+		h.samples = t.size();
+		out.put(std::string_view(reinterpret_cast<const char*>(&h), sizeof(h)));
+		out.put(std::string_view(reinterpret_cast<const char*>(t.data()), t.size() * sizeof(int64_t)));
+		out.put(std::string_view(reinterpret_cast<const char*>(v.data()), v.size() * sizeof(float)));
+	}
+
+	OutputWriter& out;
+	bool binary;
+	size_t pre_samples;
+	size_t post_samples;
+
+	// recent samples
+	std::vector<int64_t> ring_t;
+	std::vector<float> ring_v;
+	size_t ring_pos = 0;
+	size_t ring_count = 0;
+
+	// pattern being collected (0 if none)
+	int patternid = 0;
+	long long alarm_lineid = 0;
+	int64_t alarm_t = 0;
+	std::string alarm_timestamp;
+	size_t pre_count = 0;
+	std::vector<int64_t> t;
+	std::vector<float> v;
+};
+
+
+
+// pattern records written to a file
+class PatternFile {
+public:
+	~PatternFile() {
+		// buffered records are written before the file is closed
+		extractor_.reset();
+		out.reset();
+		if (fd >= 0)
+			::close(fd);
+	}
+
+	// creates file and extractor, false with a message on error
+	bool open(const char* filename, bool binary, size_t pre_samples, size_t post_samples) {
+		fd = ::open(filename, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+		if (fd < 0) {
+			std::cerr << "Cannot open " << filename << ": " << strerror(errno) << std::endl;
+			return false;
+		}
+		out.reset(new OutputWriter(fd, FLUSH_EXIT));
+		extractor_.reset(new PatternExtractor(*out, binary, pre_samples, post_samples));
+		extractor_->header();
+		return true;
+	}
+
+	// extractor to pass samples to, nullptr if not opened
+	PatternExtractor* extractor() { return extractor_.get(); }
+
+	// writes pattern in progress and all buffered records, false with a message on error
+	bool close() {
+		if (!out)
+			return true;
+		extractor_->finish();
+		out->flush();
+		if (out->failed()) {
+			std::cerr << "Pattern output write error: " << strerror(out->error()) << std::endl;
+			return false;
+		}
+		return true;
+	}
+
+private:
+	int fd = -1;
+	std::unique_ptr<OutputWriter> out;
+	std::unique_ptr<PatternExtractor> extractor_;   // writes to out
+};
+
+#endif /* FP_PATTERNS_H_ */
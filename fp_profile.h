@@ -0,0 +1,229 @@
+//============================================================================
+// Name        : fp_profile.h
+// Description : Noise profile of a sensor from a calibration pass
+//============================================================================
+
+/*
+INITIAL_AVG_DIFF is only a guess of the noise level; until diffavg has
+converged to the real one, detection is too sensitive or too dull. A
+calibration pass over the first samples of a sensor (or a reference capture)
+computes its noise profile, which the main run loads to start with a
+converged diffavg:
+
+NoiseCalibrator calibrator(params);
+calibrator.add(t_usec, values, n);      // sampled samples in input order, any number of calls
+NoiseProfile profile = calibrator.profile();
+if (!profile.save(filename))
+	... profile.error()
+...
+if (!profile.load(filename))
+	... profile.error()
+params.initial_avg_diff = profile.initial_avg_diff;
+
+Absolute differences and timestamp intervals are counted in log-linear
+histograms (LatencyHistogram of fp_histogram.h), so memory is constant
+regardless of the number of samples and quantiles are within 1/64 of the
+real value (exact below 128).
+
+diffavg of the detector is amended by differences below
+MULTIPLICATOR_TO_DETECT * diffavg only, so it settles where it equals the
+mean of differences below that threshold. The suggested initial_avg_diff is
+this fixed point, found by iterating over the difference histogram from the
+mean of all differences downwards; it does not depend on the initial guess.
+
+The profile file holds "key value" lines (# starts a comment line):
+
+samples N              number of calibration samples
+initial_avg_diff X     suggested INITIAL_AVG_DIFF
+diff_mean X            mean absolute difference of all samples
+diff_p50 N ... diff_p999 N, diff_max N   quantiles of absolute differences
+interval_p50_usec N    median interval between samples
+sample_rate_hz X       1e6 / interval_p50_usec
+
+Only initial_avg_diff is required by load(), other keys are informative.
+ */
+
+#ifndef FP_PROFILE_H_
+#define FP_PROFILE_H_
+
+#include <string>
+#include <fstream>
+#include <sstream>
+#include <cstdint>
+#include <cstdlib>
+#include <cmath>
+#include <memory>
+
+#include "fp_detector.h"
+#include "fp_histogram.h"
+
+// Iterations of the diffavg fixed point search
+#define PROFILE_MAX_ITERATIONS 100
+
+struct NoiseProfile {
+	uint64_t samples = 0;
+	double initial_avg_diff = 0;
+	double diff_mean = 0;
+	uint64_t diff_p50 = 0, diff_p90 = 0, diff_p99 = 0, diff_p999 = 0, diff_max = 0;
+	uint64_t interval_p50_usec = 0;
+	double sample_rate_hz = 0;
+
+	// writes the profile file, false with error message in error()
+	bool save(const char* filename) {
+		std::ofstream f(filename);
+		if (!f)
+			return fail(std::string("cannot create profile ") + filename);
+		f << "# noise profile, see fp_profile.h" << std::endl;
+		f << "samples " << samples << std::endl;
+		f << "initial_avg_diff " << initial_avg_diff << std::endl;
+		f << "diff_mean " << diff_mean << std::endl;
+		f << "diff_p50 " << diff_p50 << std::endl;
+		f << "diff_p90 " << diff_p90 << std::endl;
+		f << "diff_p99 " << diff_p99 << std::endl;
+		f << "diff_p999 " << diff_p999 << std::endl;
+		f << "diff_max " << diff_max << std::endl;
+		f << "interval_p50_usec " << interval_p50_usec << std::endl;
+		f << "sample_rate_hz " << sample_rate_hz << std::endl;
+		f.close();
+		if (!f)
+			return fail(std::string("cannot write profile ") + filename);
+		return true;
+	}
+
+	// reads the profile file, false with error message in error()
+	bool load(const char* filename) {
+		std::ifstream f(filename);
+		if (!f)
+			return fail(std::string("cannot open profile ") + filename);
+		std::string line;
+		int lineno = 0;
+		bool has_avg_diff = false;
+		while (std::getline(f, line)) {
+			lineno++;
+			std::istringstream is(line);
+			std::string key;
+			double value;
+			if (!(is >> key) || key[0] == '#')
+				continue;
+			if (!(is >> value))
+				return fail(std::string(filename) + ":" + std::to_string(lineno) + ": missing value of " + key);
+			if (key == "samples")
+				samples = value;
+			else if (key == "initial_avg_diff") {
+				initial_avg_diff = value;
+				has_avg_diff = true;
+			} else if (key == "diff_mean")
+				diff_mean = value;
+			else if (key == "diff_p50")
+				diff_p50 = value;
+			else if (key == "diff_p90")
+				diff_p90 = value;
+			else if (key == "diff_p99")
+				diff_p99 = value;
+			else if (key == "diff_p999")
+				diff_p999 = value;
+			else if (key == "diff_max")
+				diff_max = value;
+			else if (key == "interval_p50_usec")
+				interval_p50_usec = value;
+			else if (key == "sample_rate_hz")
+				sample_rate_hz = value;
+			// unknown keys of newer versions are ignored
+		}
+		if (!has_avg_diff)
+			return fail(std::string(filename) + ": no initial_avg_diff in the profile");
+		return true;
+	}
+
+	const std::string& error() const { return err; }
+
+private:
+	bool fail(const std::string& message) {
+		err = message;
+		return false;
+	}
+
+	std::string err;
+};
+
+
+class NoiseCalibrator {
+public:
+	// thresholds of params decide which differences are noise
+	explicit NoiseCalibrator(const AlarmNoiseRejectParams& params)
+		: multiplicator(params.multiplicator_to_detect),
+		  diffs(new LatencyHistogram), intervals(new LatencyHistogram) {}
+
+	// adds n samples following the previous ones
+	void add(const int64_t* t_usec, const float* values, size_t n) {
+		for (size_t i = 0; i < n; i++) {
+			if (count) {
+				// truncated to integer as by the detector
+				diffs->record(std::abs(static_cast<int>(values[i] - lastval)));
+				if (t_usec[i] > last_t)
+					intervals->record(t_usec[i] - last_t);
+			}
+			lastval = values[i];
+			last_t = t_usec[i];
+			count++;
+		}
+	}
+
+	// number of samples added
+	uint64_t size() const { return count; }
+
+	NoiseProfile profile() const {
+		NoiseProfile p;
+		p.samples = count;
+		p.diff_mean = mean_below(INFINITY);
+		p.initial_avg_diff = settled_avg_diff(p.diff_mean);
+		p.diff_p50 = diffs->percentile(0.5);
+		p.diff_p90 = diffs->percentile(0.9);
+		p.diff_p99 = diffs->percentile(0.99);
+		p.diff_p999 = diffs->percentile(0.999);
+		p.diff_max = diffs->percentile(1);
+		p.interval_p50_usec = intervals->percentile(0.5);
+		p.sample_rate_hz = p.interval_p50_usec ? 1e6 / p.interval_p50_usec : 0;
+		return p;
+	}
+
+private:
+	// mean of differences below limit, 0 if none (values of a bucket taken as its middle)
+	double mean_below(double limit) const {
+		double sum = 0;
+		uint64_t n = 0;
+		uint64_t low = 0;
+		for (int i = 0; i < LATENCY_BUCKETS && low < limit; i++) {
+			uint64_t high = LatencyHistogram::bucket_high(i);
+			double mid = (low + high) / 2.0;
+			if (mid < limit) {
+				uint64_t k = diffs->bucket_count(i);
+				sum += mid * k;
+				n += k;
+			}
+			low = high + 1;
+		}
+		return n ? sum / n : 0;
+	}
+
+	// diffavg the detector settles at: mean of differences below multiplicator * itself
+	double settled_avg_diff(double mean) const {
+		double avg = mean;
+		for (int i = 0; i < PROFILE_MAX_ITERATIONS; i++) {
+			double next = mean_below(multiplicator * avg);
+			if (next == 0 || std::fabs(next - avg) < 0.01 * avg / multiplicator)
+				return next ? next : avg;
+			avg = next;
+		}
+		return avg;
+	}
+
+	double multiplicator;
+	std::unique_ptr<LatencyHistogram> diffs;       // absolute differences
+	std::unique_ptr<LatencyHistogram> intervals;   // timestamp intervals (usec)
+	uint64_t count = 0;
+	float lastval = 0;
+	int64_t last_t = 0;
+};
+
+#endif /* FP_PROFILE_H_ */
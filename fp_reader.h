@@ -0,0 +1,264 @@
+//============================================================================
+// Name        : fp_reader.h
+// Description : Zero-copy line reader for timestamp;value input
+//============================================================================
+
+/*
+Input lines are returned as std::string_view slices, no heap allocation is
+done per line.
+
+If the input descriptor is a regular file (e.g. ./fp_generate_patterns < testdata.csv),
+the file is memory mapped and walked directly. Otherwise (pipe, socket, terminal)
+data are read using large read() calls into two alternating buffers; an incomplete
+line at the end of a block is moved to the front of the other buffer before the next read.
+
+A line returned by next_line() stays valid until the next-but-one buffer refill
+(always for mmaped input), so the caller has to copy whatever it keeps longer.
+
+Fixed size binary records may be read the same way by next_record().
+
+A refill hook may be set to be called before each read() (i.e. before the
+reader possibly waits for input), e.g. to flush buffered output.
+offset() is the number of input bytes consumed so far (up to the end of
+the last returned line), skip() consumes given number of bytes, e.g. to
+continue after a checkpoint (see fp_checkpoint.h); line_terminated() tells
+whether the last line was complete.
+
+Time spent in read() is counted in program_stats.read_ns (see fp_stats.h),
+the time the last block was read is returned by block_read_ns().
+ */
+
+#ifndef FP_READER_H_
+#define FP_READER_H_
+
+#include <string_view>
+#include <vector>
+#include <functional>
+#include <charconv>
+#include <cstring>
+#include <cerrno>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "fp_stats.h"
+
+// Size of one read() block when input is not mmapable
+#define INPUT_BLOCK_SIZE (1 << 20)
+
+
+// trims leading and trailing spaces
+inline std::string_view trim(std::string_view str)
+{
+	size_t first = str.find_first_not_of(' ');
+	if (std::string_view::npos == first)
+	{
+		return str;
+	}
+	size_t last = str.find_last_not_of(' ');
+	return str.substr(first, (last - first + 1));
+}
+
+// splits line into trimmed timestamp (before ;) and value (after ;)
+// if there is no ; in the line, both fields get the whole line
+inline void split_fields(std::string_view line, std::string_view& timestamp, std::string_view& value) {
+	size_t pos = line.find(';');
+	timestamp = trim(line.substr(0, pos));
+	value = (pos == std::string_view::npos) ? trim(line) : trim(line.substr(pos + 1));
+}
+
+// parses n values separated by ; (e.g. the part after timestamp of a wide row)
+// false if there are less than n numbers
+template <class T>
+inline bool parse_values(std::string_view fields, T* values, size_t n) {
+	for (size_t i = 0; i < n; i++) {
+		size_t pos = fields.find(';');
+		std::string_view field = trim(fields.substr(0, pos));
+		double value;
+		if (std::from_chars(field.data(), field.data() + field.size(), value).ec != std::errc())
+			return false;
+		values[i] = value;
+		if (pos == std::string_view::npos) {
+			if (i + 1 < n)
+				return false;
+			break;
+		}
+		fields.remove_prefix(pos + 1);
+	}
+	return true;
+}
+
+
+class InputReader {
+public:
+	explicit InputReader(int fd, size_t block_size = INPUT_BLOCK_SIZE) : fd(fd), block_size(block_size) {
+		struct stat st;
+		if (fstat(fd, &st) == 0 && S_ISREG(st.st_mode)) {
+			// start from the current position (input may have been positioned by the caller)
+			off_t offset = lseek(fd, 0, SEEK_CUR);
+			if (offset < 0)
+				offset = 0;
+			if (st.st_size > offset) {
+				void* p = mmap(nullptr, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+				if (p != MAP_FAILED) {
+					madvise(p, st.st_size, MADV_SEQUENTIAL);
+					map = static_cast<const char*>(p);
+					map_size = st.st_size;
+					pos = start = map + offset;
+					end = map + map_size;
+					eof = true;
+					return;
+				}
+			} else {
+				// nothing to read
+				eof = true;
+				return;
+			}
+		}
+		// fall back to block reads
+		buffers[0].resize(block_size);
+		buffers[1].resize(block_size);
+		pos = end = buffers[0].data();
+	}
+
+	~InputReader() {
+		if (map)
+			munmap(const_cast<char*>(map), map_size);
+	}
+
+	InputReader(const InputReader&) = delete;
+	InputReader& operator=(const InputReader&) = delete;
+
+	// returns next line without the terminating '\n', false at the end of input
+	bool next_line(std::string_view& line) {
+		for (;;) {
+			const char* nl = (pos < end) ? static_cast<const char*>(memchr(pos, '\n', end - pos)) : nullptr;
+			if (nl) {
+				line = std::string_view(pos, nl - pos);
+				pos = nl + 1;
+				return true;
+			}
+			if (eof) {
+				// last line without terminating '\n'
+				if (pos == end)
+					return false;
+				line = std::string_view(pos, end - pos);
+				pos = end;
+				unterminated = true;
+				return true;
+			}
+			refill();
+		}
+	}
+
+	// returns pointer to next record of size bytes, false at the end of input
+	// (incomplete record at the end is ignored)
+	bool next_record(size_t size, const char*& record) {
+		while (static_cast<size_t>(end - pos) < size) {
+			if (eof)
+				return false;
+			refill();
+		}
+		record = pos;
+		pos += size;
+		return true;
+	}
+
+	// bytes consumed since the reader was created
+	uint64_t offset() const {
+		return map ? pos - start : read_total - (end - pos);
+	}
+
+	// false if the last returned line had no terminating '\n' (e.g. input cut while being written)
+	bool line_terminated() const { return !unterminated; }
+
+	// consumes bytes of input, false if the input is shorter
+	bool skip(uint64_t bytes) {
+		for (;;) {
+			size_t available = end - pos;
+			if (bytes <= available) {
+				pos += bytes;
+				return true;
+			}
+			pos = end;
+			bytes -= available;
+			if (eof)
+				return false;
+			refill();
+		}
+	}
+
+	// sets function called before each block read
+	void set_refill_hook(std::function<void()> hook) { refill_hook = std::move(hook); }
+
+	// true if the input is memory mapped
+	bool is_mapped() const { return map != nullptr; }
+
+	// steady clock time (ns) when the current block was read, 0 for mapped input
+	int64_t block_read_ns() const { return block_time; }
+
+	// false if there is no read error
+	bool failed() const { return read_error != 0; }
+	int error() const { return read_error; }
+
+private:
+	// moves incomplete tail of the current buffer to the other buffer and reads next block
+	void refill() {
+		if (refill_hook)
+			refill_hook();
+
+		std::vector<char>& next = buffers[cur ^ 1];
+		size_t tail = end - pos;
+
+		// line longer than buffer, make buffers larger
+		if (tail + block_size > next.size()) {
+			next.resize(tail + block_size);
+		}
+		if (tail)
+			memmove(next.data(), pos, tail);
+		cur ^= 1;
+
+		ssize_t n;
+		STATS_READ_START();
+		do {
+			n = read(fd, next.data() + tail, next.size() - tail);
+		} while (n < 0 && errno == EINTR);
+		STATS_READ_END();
+		block_time = stats_now_ns();
+
+		if (n <= 0) {
+			if (n < 0)
+				read_error = errno;
+			eof = true;
+			n = 0;
+		}
+		read_total += n;
+		pos = next.data();
+		end = next.data() + tail + n;
+	}
+
+	int fd;
+	size_t block_size;
+
+	// mmaped input, start is the position at creation
+	const char* map = nullptr;
+	const char* start = nullptr;
+	size_t map_size = 0;
+
+	// buffered input
+	std::vector<char> buffers[2];
+	int cur = 0;
+
+	// current position and end of valid data
+	const char* pos = nullptr;
+	const char* end = nullptr;
+	bool eof = false;
+	int read_error = 0;
+	int64_t block_time = 0;
+	uint64_t read_total = 0;
+	bool unterminated = false;
+
+	std::function<void()> refill_hook;
+};
+
+#endif /* FP_READER_H_ */
@@ -0,0 +1,389 @@
+//============================================================================
+// Name        : fp_server.h
+// Description : Multi-stream line server over Unix domain or TCP sockets
+//============================================================================
+
+/*
+Accepts any number of connections on one listening socket and passes the
+data of each connection, split to complete lines, to its own session:
+
+StreamServer server([&](long long id, const std::string& peer) {
+	return std::unique_ptr<StreamSession>(new MySession(id, peer));
+});
+if (!server.listen("unix:/tmp/fp.sock") || !server.run(threads))
+	... server.error()
+
+Addresses are unix:PATH (a stale socket file at PATH is replaced, the file is
+removed when the server is destroyed) or tcp:HOST:PORT (HOST empty for the
+loopback interface only).
+
+A connection is closed (with a message to stderr) when it sends a line longer
+than STREAM_MAX_LINE bytes. When accepting fails (e.g. out of file descriptors),
+the thread stops waiting on the listening socket for STREAM_ACCEPT_BACKOFF_MS
+and serves its connections meanwhile.
+
+Connections are multiplexed by epoll on the given number of threads. Every
+thread waits on the listening socket (EPOLLEXCLUSIVE, so one thread is woken
+per connection) and serves the connections it has accepted, so a session is
+always called from the same thread and needs no locking of its own state.
+
+run() returns after stop() is called (it is async-signal-safe, e.g. for a
+SIGTERM handler); all sessions get their last incomplete line and end() then.
+ */
+
+#ifndef FP_SERVER_H_
+#define FP_SERVER_H_
+
+#include <string>
+#include <string_view>
+#include <vector>
+#include <memory>
+#include <algorithm>
+#include <functional>
+#include <unordered_map>
+#include <thread>
+#include <atomic>
+#include <chrono>
+#include <cstring>
+#include <cerrno>
+#include <cstdint>
+#include <iostream>
+#include <unistd.h>
+#include <netdb.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+
+// Initial size of the read buffer of a connection (grows for longer lines)
+#define STREAM_BUFFER_SIZE (64 * 1024)
+
+// Maximum length of an input line with its '\n' (size the read buffer may grow to),
+// a connection sending a longer line is closed
+#define STREAM_MAX_LINE (1024 * 1024)
+
+// Number of epoll events taken at once
+#define STREAM_EPOLL_EVENTS 64
+
+// Pause of accepting after accept failed (e.g. out of file descriptors), milliseconds
+#define STREAM_ACCEPT_BACKOFF_MS 100
+
+
+// one input stream (connection)
+class StreamSession {
+public:
+	virtual ~StreamSession() {}
+
+	// complete lines, each terminated by '\n' (except the last line of the stream)
+	virtual void input(std::string_view lines) = 0;
+
+	// end of the stream, connection is closed or server stopped
+	virtual void end() = 0;
+};
+
+// creates session of new connection id (1, 2, ...) from peer address
+typedef std::function<std::unique_ptr<StreamSession>(long long id, const std::string& peer)> StreamSessionFactory;
+
+
+class StreamServer {
+public:
+	explicit StreamServer(StreamSessionFactory factory) : factory(std::move(factory)) {}
+
+	~StreamServer() {
+		if (listen_fd >= 0)
+			close(listen_fd);
+		if (stop_fd >= 0)
+			close(stop_fd);
+		if (!unix_path.empty())
+			unlink(unix_path.c_str());
+	}
+
+	StreamServer(const StreamServer&) = delete;
+	StreamServer& operator=(const StreamServer&) = delete;
+
+	// creates listening socket, false with error message in error()
+	bool listen(const char* address) {
+		stop_fd = eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK);
+		if (stop_fd < 0)
+			return fail(std::string("cannot create eventfd: ") + strerror(errno));
+
+		std::string_view addr(address);
+		if (addr.substr(0, 5) == "unix:")
+			return listen_unix(std::string(addr.substr(5)));
+		if (addr.substr(0, 4) == "tcp:") {
+			std::string_view hostport = addr.substr(4);
+			size_t colon = hostport.rfind(':');
+			if (colon == std::string_view::npos || colon + 1 == hostport.size())
+				return fail(std::string("invalid address ") + address + " (tcp:HOST:PORT)");
+			return listen_tcp(std::string(hostport.substr(0, colon)), std::string(hostport.substr(colon + 1)));
+		}
+		return fail(std::string("invalid address ") + address + " (unix:PATH or tcp:HOST:PORT)");
+	}
+
+	// serves connections on threads until stop(), false with error message in error()
+	bool run(int threads) {
+		std::vector<std::thread> workers;
+		for (int i = 1; i < threads; i++)
+			workers.emplace_back([this] { serve(); });
+		serve();
+		for (std::thread& w : workers)
+			w.join();
+		return err.empty();
+	}
+
+	// ends run(), may be called from a signal handler
+	void stop() {
+		uint64_t one = 1;
+		if (stop_fd >= 0 && write(stop_fd, &one, sizeof(one)) < 0) {
+			// counter overflow only, already stopped
+		}
+	}
+
+	const std::string& error() const { return err; }
+
+private:
+	struct Connection {
+		long long id = 0;
+		std::unique_ptr<StreamSession> session;
+		std::vector<char> buffer;
+		size_t used = 0;
+	};
+
+	bool listen_unix(const std::string& path) {
+		sockaddr_un sa;
+		memset(&sa, 0, sizeof(sa));
+		sa.sun_family = AF_UNIX;
+		if (path.empty() || path.size() >= sizeof(sa.sun_path))
+			return fail("invalid unix socket path " + path);
+		memcpy(sa.sun_path, path.c_str(), path.size());
+
+		// replace stale socket of a previous run
+		struct stat st;
+		if (stat(path.c_str(), &st) == 0 && S_ISSOCK(st.st_mode))
+			unlink(path.c_str());
+
+		listen_fd = socket(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+		if (listen_fd < 0)
+			return fail(std::string("cannot create socket: ") + strerror(errno));
+		if (bind(listen_fd, reinterpret_cast<sockaddr*>(&sa), sizeof(sa)) < 0)
+			return fail("cannot bind " + path + ": " + strerror(errno));
+		unix_path = path;
+		return start_listening(path);
+	}
+
+	bool listen_tcp(const std::string& host, const std::string& port) {
+		addrinfo hints, *res;
+		memset(&hints, 0, sizeof(hints));
+		hints.ai_family = AF_UNSPEC;
+		hints.ai_socktype = SOCK_STREAM;
+		int rc = getaddrinfo(host.empty() ? "127.0.0.1" : host.c_str(), port.c_str(), &hints, &res);
+		if (rc)
+			return fail("cannot resolve " + host + ":" + port + ": " + gai_strerror(rc));
+
+		listen_fd = socket(res->ai_family, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+		if (listen_fd < 0) {
+			freeaddrinfo(res);
+			return fail(std::string("cannot create socket: ") + strerror(errno));
+		}
+		int on = 1;
+		setsockopt(listen_fd, SOL_SOCKET, SO_REUSEADDR, &on, sizeof(on));
+		rc = bind(listen_fd, res->ai_addr, res->ai_addrlen);
+		freeaddrinfo(res);
+		if (rc < 0)
+			return fail("cannot bind " + host + ":" + port + ": " + strerror(errno));
+		return start_listening(host + ":" + port);
+	}
+
+	bool start_listening(const std::string& name) {
+		if (::listen(listen_fd, SOMAXCONN) < 0)
+			return fail("cannot listen on " + name + ": " + strerror(errno));
+		return true;
+	}
+
+	// peer address of accepted socket as text
+	static std::string peer_name(const sockaddr_storage& sa) {
+		char host[INET6_ADDRSTRLEN] = "";
+		if (sa.ss_family == AF_INET) {
+			const sockaddr_in* in = reinterpret_cast<const sockaddr_in*>(&sa);
+			inet_ntop(AF_INET, &in->sin_addr, host, sizeof(host));
+			return std::string(host) + ":" + std::to_string(ntohs(in->sin_port));
+		}
+		if (sa.ss_family == AF_INET6) {
+			const sockaddr_in6* in = reinterpret_cast<const sockaddr_in6*>(&sa);
+			inet_ntop(AF_INET6, &in->sin6_addr, host, sizeof(host));
+			return std::string("[") + host + "]:" + std::to_string(ntohs(in->sin6_port));
+		}
+		return "unix";
+	}
+
+	// event loop of one thread
+	void serve() {
+		int epfd = epoll_create1(EPOLL_CLOEXEC);
+		if (epfd < 0) {
+			fail_async(std::string("cannot create epoll: ") + strerror(errno));
+			stop();
+			return;
+		}
+		watch_listen(epfd);
+		epoll_event ev;
+		ev.events = EPOLLIN;
+		ev.data.fd = stop_fd;
+		epoll_ctl(epfd, EPOLL_CTL_ADD, stop_fd, &ev);
+
+		std::unordered_map<int, Connection> connections;
+		epoll_event events[STREAM_EPOLL_EVENTS];
+		bool stopping = false;
+
+		// while accepting is paused, the listening socket is out of epfd until then
+		bool accept_paused = false;
+		std::chrono::steady_clock::time_point accept_resume;
+
+		while (!stopping) {
+			int timeout = -1;
+			if (accept_paused) {
+				auto left = std::chrono::duration_cast<std::chrono::milliseconds>(accept_resume - std::chrono::steady_clock::now());
+				timeout = left.count() > 0 ? static_cast<int>(left.count()) + 1 : 0;
+			}
+			int n = epoll_wait(epfd, events, STREAM_EPOLL_EVENTS, timeout);
+			if (n < 0) {
+				if (errno == EINTR)
+					continue;
+				fail_async(std::string("epoll_wait failed: ") + strerror(errno));
+				break;
+			}
+			if (accept_paused && std::chrono::steady_clock::now() >= accept_resume) {
+				watch_listen(epfd);
+				accept_paused = false;
+			}
+			for (int i = 0; i < n; i++) {
+				int fd = events[i].data.fd;
+				if (fd == stop_fd)
+					stopping = true;
+				else if (fd == listen_fd) {
+					// the pending connection would wake epoll again at once, so it waits
+					if (!accept_paused && !accept_all(epfd, connections)) {
+						epoll_ctl(epfd, EPOLL_CTL_DEL, listen_fd, nullptr);
+						accept_paused = true;
+						accept_resume = std::chrono::steady_clock::now() + std::chrono::milliseconds(STREAM_ACCEPT_BACKOFF_MS);
+					}
+				} else if (!read_connection(fd, connections[fd])) {
+					epoll_ctl(epfd, EPOLL_CTL_DEL, fd, nullptr);
+					close(fd);
+					connections.erase(fd);
+				}
+			}
+		}
+
+		// end of all streams of this thread
+		for (auto& c : connections) {
+			end_connection(c.second);
+			close(c.first);
+		}
+		close(epfd);
+	}
+
+	// waits for connections on the listening socket (one thread is woken per connection)
+	void watch_listen(int epfd) {
+		epoll_event ev;
+		ev.events = EPOLLIN | EPOLLEXCLUSIVE;
+		ev.data.fd = listen_fd;
+		epoll_ctl(epfd, EPOLL_CTL_ADD, listen_fd, &ev);
+	}
+
+	// accepts pending connections and adds them to epfd
+	// false (with a message) if accepting failed, e.g. out of file descriptors
+	bool accept_all(int epfd, std::unordered_map<int, Connection>& connections) {
+		for (;;) {
+			sockaddr_storage sa;
+			socklen_t len = sizeof(sa);
+			int fd = accept4(listen_fd, reinterpret_cast<sockaddr*>(&sa), &len, SOCK_NONBLOCK | SOCK_CLOEXEC);
+			if (fd < 0) {
+				if (errno == EAGAIN || errno == EWOULDBLOCK)
+					return true;   // taken by another thread or none left
+				if (errno == EINTR || errno == ECONNABORTED)
+					continue;
+				std::cerr << "Cannot accept connection (retrying in " << STREAM_ACCEPT_BACKOFF_MS << " ms): "
+					<< strerror(errno) << std::endl;
+				return false;
+			}
+
+			Connection& c = connections[fd];
+			c.id = ++last_id;
+			c.session = factory(c.id, peer_name(sa));
+			c.buffer.resize(STREAM_BUFFER_SIZE);
+
+			epoll_event ev;
+			ev.events = EPOLLIN;
+			ev.data.fd = fd;
+			epoll_ctl(epfd, EPOLL_CTL_ADD, fd, &ev);
+		}
+	}
+
+	// reads available data of the connection and passes complete lines
+	// false when the stream has ended
+	bool read_connection(int fd, Connection& c) {
+		if (c.used == c.buffer.size()) {
+			// line longer than buffer, the incomplete line is dropped if too long
+			if (c.buffer.size() >= STREAM_MAX_LINE) {
+				std::cerr << "Closing stream " << c.id << ": line longer than " << STREAM_MAX_LINE << " bytes" << std::endl;
+				c.used = 0;
+				end_connection(c);
+				return false;
+			}
+			c.buffer.resize(std::min<size_t>(c.buffer.size() * 2, STREAM_MAX_LINE));
+		}
+
+		ssize_t n = read(fd, c.buffer.data() + c.used, c.buffer.size() - c.used);
+		if (n < 0 && (errno == EAGAIN || errno == EINTR))
+			return true;
+		if (n <= 0) {
+			end_connection(c);
+			return false;
+		}
+
+		// complete lines up to the last '\n', the rest is kept for the next read
+		size_t scanned = c.used;
+		c.used += n;
+		const char* data = c.buffer.data();
+		const char* last = static_cast<const char*>(memrchr(data + scanned, '\n', c.used - scanned));
+		if (last) {
+			size_t complete = last + 1 - data;
+			c.session->input(std::string_view(data, complete));
+			memmove(c.buffer.data(), data + complete, c.used - complete);
+			c.used -= complete;
+		}
+		return true;
+	}
+
+	// passes the last incomplete line and ends the session
+	void end_connection(Connection& c) {
+		if (c.used)
+			c.session->input(std::string_view(c.buffer.data(), c.used));
+		c.used = 0;
+		c.session->end();
+	}
+
+	bool fail(const std::string& message) {
+		err = message;
+		return false;
+	}
+
+	// error of a serving thread, the first one is kept
+	void fail_async(const std::string& message) {
+		if (!error_set.exchange(true))
+			err = message;
+	}
+
+	StreamSessionFactory factory;
+	int listen_fd = -1;
+	int stop_fd = -1;
+	std::string unix_path;
+	std::atomic<long long> last_id{0};
+	std::atomic<bool> error_set{false};
+	std::string err;
+};
+
+#endif /* FP_SERVER_H_ */
@@ -0,0 +1,318 @@
+//============================================================================
+// Name        : fp_shm.h
+// Description : Shared-memory ring of binary samples between processes
+//============================================================================
+
+/*
+POSIX shared memory object (shm_open name, e.g. "/fp_ring") holding a
+single-producer/single-consumer ring of ShmSample records (int64 timestamp
+in microseconds since epoch UTC, float value). The acquisition process
+creates the ring and writes samples, fp_generate_patterns --shm NAME
+attaches and reads them without any text formatting or parsing.
+
+layout: ShmRingHeader (cache line separated producer and consumer indices),
+then capacity records (capacity is a power of two)
+
+producer (header only, no other dependencies than fp_spsc.h):
+
+ShmRingProducer ring;
+if (!ring.create("/fp_ring", 1 << 16))
+	... ring.error()
+ring.push(t_usec, value);     // waits while the ring is full
+ring.close();                 // end of stream, consumer stops after the last sample
+
+consumer:
+
+ShmRingConsumer ring;
+ring.attach("/fp_ring", wait);   // waits until the producer has created the ring
+while (ring.wait())              // false at the end of stream
+	n = ring.read(samples, max);
+
+Waiting sides announce themselves in the header and sleep on a futex word
+that the other side increments (and wakes) only when someone is waiting,
+so no system call is made while data flow. With SHM_WAIT_POLL, the consumer
+polls (spins and yields) instead of sleeping, for the lowest latency at the
+cost of a busy CPU.
+
+The producer removes the name in close() (or its destructor), an attached
+consumer keeps its mapping until it has read everything.
+ */
+
+#ifndef FP_SHM_H_
+#define FP_SHM_H_
+
+#include <string>
+#include <atomic>
+#include <cstdint>
+#include <cstring>
+#include <cerrno>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sched.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "fp_spsc.h"
+
+#define SHM_RING_MAGIC "FPSHMRG"
+#define SHM_RING_VERSION 1
+
+// How long the consumer sleeps between attempts to open the ring (usec)
+#define SHM_ATTACH_RETRY_USEC 10000
+
+struct ShmSample {
+	int64_t t_usec;
+	float value;
+	uint32_t reserved;
+};
+
+struct ShmRingHeader {
+	char magic[8];              // SHM_RING_MAGIC
+	uint32_t version;
+	uint32_t record_size;       // sizeof(ShmSample)
+	uint32_t capacity;          // number of records, power of two
+	std::atomic<uint32_t> ready;    // 1 when the header is complete
+
+	// written by producer
+	alignas(64) std::atomic<uint32_t> head;
+	std::atomic<uint32_t> closed;
+	std::atomic<uint32_t> data_seq;         // incremented when data arrive for a waiting consumer
+	std::atomic<uint32_t> consumer_waiting;
+
+	// written by consumer
+	alignas(64) std::atomic<uint32_t> tail;
+	std::atomic<uint32_t> space_seq;        // incremented when space is freed for a waiting producer
+	std::atomic<uint32_t> producer_waiting;
+};
+
+static_assert(std::atomic<uint32_t>::is_always_lock_free, "shared atomics must be lock free");
+
+enum ShmWait {
+	SHM_WAIT_FUTEX,   // spin shortly, then sleep
+	SHM_WAIT_POLL     // spin and yield, never sleep
+};
+
+// bytes of the shared object of capacity records
+inline size_t shm_ring_size(uint32_t capacity) {
+	return (sizeof(ShmRingHeader) + 63) / 64 * 64 + static_cast<size_t>(capacity) * sizeof(ShmSample);
+}
+
+
+// mapping common to both sides
+class ShmRing {
+public:
+	ShmRing() {}
+	~ShmRing() { unmap(); }
+
+	ShmRing(const ShmRing&) = delete;
+	ShmRing& operator=(const ShmRing&) = delete;
+
+	const std::string& error() const { return err; }
+
+protected:
+	ShmSample* records() const {
+		return reinterpret_cast<ShmSample*>(reinterpret_cast<char*>(hdr) + (sizeof(ShmRingHeader) + 63) / 64 * 64);
+	}
+
+	void unmap() {
+		if (hdr)
+			munmap(hdr, size);
+		hdr = nullptr;
+	}
+
+	bool fail(const std::string& message) {
+		err = message;
+		return false;
+	}
+
+	ShmRingHeader* hdr = nullptr;
+	size_t size = 0;
+	uint32_t mask = 0;
+	std::string err;
+};
+
+
+class ShmRingProducer : public ShmRing {
+public:
+	~ShmRingProducer() { close(); }
+
+	// creates the ring (replacing an old one of the same name), false with error message in error()
+	bool create(const char* ring_name, uint32_t capacity) {
+		if (!capacity || (capacity & (capacity - 1)) || capacity > (1u << 30))
+			return fail("ring capacity must be a power of two up to 2^30");
+		shm_unlink(ring_name);
+		int fd = shm_open(ring_name, O_RDWR | O_CREAT | O_EXCL, 0600);
+		if (fd < 0)
+			return fail(std::string("cannot create shared memory ") + ring_name + ": " + strerror(errno));
+		size = shm_ring_size(capacity);
+		if (ftruncate(fd, size) < 0) {
+			::close(fd);
+			shm_unlink(ring_name);
+			return fail(std::string("cannot size shared memory ") + ring_name + ": " + strerror(errno));
+		}
+		void* p = mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+		::close(fd);
+		if (p == MAP_FAILED) {
+			shm_unlink(ring_name);
+			return fail(std::string("cannot map shared memory ") + ring_name + ": " + strerror(errno));
+		}
+
+		// new object is zero filled, only constants are set
+		hdr = static_cast<ShmRingHeader*>(p);
+		memcpy(hdr->magic, SHM_RING_MAGIC, sizeof(hdr->magic));
+		hdr->version = SHM_RING_VERSION;
+		hdr->record_size = sizeof(ShmSample);
+		hdr->capacity = capacity;
+		hdr->ready.store(1, std::memory_order_release);
+		mask = capacity - 1;
+		name = ring_name;
+		return true;
+	}
+
+	// writes n samples, waits while the ring is full
+	void write(const ShmSample* samples, size_t n) {
+		while (n) {
+			uint32_t h = hdr->head.load(std::memory_order_relaxed);
+			uint32_t free = mask + 1 - (h - hdr->tail.load(std::memory_order_acquire));
+			if (!free) {
+				wait_space(h);
+				continue;
+			}
+			size_t k = n < free ? n : free;
+			ShmSample* r = records();
+			for (size_t i = 0; i < k; i++)
+				r[(h + i) & mask] = samples[i];
+			hdr->head.store(h + k, std::memory_order_seq_cst);
+			if (hdr->consumer_waiting.load(std::memory_order_seq_cst)) {
+				hdr->data_seq.fetch_add(1, std::memory_order_seq_cst);
+				futex_wake(&hdr->data_seq);
+			}
+			samples += k;
+			n -= k;
+		}
+	}
+
+	void push(int64_t t_usec, float value) {
+		ShmSample s = { t_usec, value, 0 };
+		write(&s, 1);
+	}
+
+	// ends the stream and removes the name
+	void close() {
+		if (!hdr)
+			return;
+		hdr->closed.store(1, std::memory_order_seq_cst);
+		hdr->data_seq.fetch_add(1, std::memory_order_seq_cst);
+		futex_wake(&hdr->data_seq);
+		unmap();
+		shm_unlink(name.c_str());
+	}
+
+private:
+	// waits until the consumer frees space (tail moves away from head - capacity)
+	void wait_space(uint32_t h) {
+		for (int spin = 0; spin < SPSC_SPIN_COUNT; spin++) {
+			if (h - hdr->tail.load(std::memory_order_acquire) <= mask)
+				return;
+			cpu_relax();
+		}
+		uint32_t seq = hdr->space_seq.load(std::memory_order_seq_cst);
+		hdr->producer_waiting.store(1, std::memory_order_seq_cst);
+		if (h - hdr->tail.load(std::memory_order_seq_cst) > mask)
+			futex_wait(&hdr->space_seq, seq);
+		hdr->producer_waiting.store(0, std::memory_order_relaxed);
+	}
+
+	std::string name;
+};
+
+
+class ShmRingConsumer : public ShmRing {
+public:
+	// maps the ring, waiting until the producer has created it, false with error message in error()
+	bool attach(const char* ring_name, ShmWait wait_mode = SHM_WAIT_FUTEX) {
+		mode = wait_mode;
+		int fd;
+		for (;;) {
+			fd = shm_open(ring_name, O_RDWR, 0);
+			if (fd >= 0)
+				break;
+			if (errno != ENOENT)
+				return fail(std::string("cannot open shared memory ") + ring_name + ": " + strerror(errno));
+			usleep(SHM_ATTACH_RETRY_USEC);
+		}
+
+		// size is set by the producer right after creation
+		struct stat st;
+		while (fstat(fd, &st) == 0 && static_cast<size_t>(st.st_size) < sizeof(ShmRingHeader))
+			usleep(SHM_ATTACH_RETRY_USEC);
+		size = st.st_size;
+		void* p = mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+		::close(fd);
+		if (p == MAP_FAILED)
+			return fail(std::string("cannot map shared memory ") + ring_name + ": " + strerror(errno));
+		hdr = static_cast<ShmRingHeader*>(p);
+
+		while (!hdr->ready.load(std::memory_order_acquire))
+			usleep(SHM_ATTACH_RETRY_USEC);
+		if (memcmp(hdr->magic, SHM_RING_MAGIC, sizeof(hdr->magic)) || hdr->version != SHM_RING_VERSION
+				|| hdr->record_size != sizeof(ShmSample))
+			return fail(std::string(ring_name) + " is not a sample ring (or unsupported version)");
+		if (size < shm_ring_size(hdr->capacity))
+			return fail(std::string(ring_name) + ": shared memory is truncated");
+		mask = hdr->capacity - 1;
+		return true;
+	}
+
+	// copies up to max available samples to out, returns their number (0 if none available)
+	size_t read(ShmSample* out, size_t max) {
+		uint32_t t = hdr->tail.load(std::memory_order_relaxed);
+		uint32_t n = hdr->head.load(std::memory_order_acquire) - t;
+		if (n > max)
+			n = max;
+		const ShmSample* r = records();
+		for (uint32_t i = 0; i < n; i++)
+			out[i] = r[(t + i) & mask];
+		if (n) {
+			hdr->tail.store(t + n, std::memory_order_seq_cst);
+			if (hdr->producer_waiting.load(std::memory_order_seq_cst)) {
+				hdr->space_seq.fetch_add(1, std::memory_order_seq_cst);
+				futex_wake(&hdr->space_seq);
+			}
+		}
+		return n;
+	}
+
+	// true if samples are available, waits for them; false at the end of stream
+	bool wait() {
+		for (int spin = 0;; spin++) {
+			if (available())
+				return true;
+			if (hdr->closed.load(std::memory_order_acquire))
+				return available();
+
+			if (spin < SPSC_SPIN_COUNT) {
+				cpu_relax();
+				continue;
+			}
+			if (mode == SHM_WAIT_POLL) {
+				sched_yield();
+				continue;
+			}
+			uint32_t seq = hdr->data_seq.load(std::memory_order_seq_cst);
+			hdr->consumer_waiting.store(1, std::memory_order_seq_cst);
+			if (!available() && !hdr->closed.load(std::memory_order_seq_cst))
+				futex_wait(&hdr->data_seq, seq);
+			hdr->consumer_waiting.store(0, std::memory_order_relaxed);
+		}
+	}
+
+private:
+	bool available() const {
+		return hdr->head.load(std::memory_order_acquire) != hdr->tail.load(std::memory_order_relaxed);
+	}
+
+	ShmWait mode = SHM_WAIT_FUTEX;
+};
+
+#endif /* FP_SHM_H_ */
@@ -0,0 +1,139 @@
+//============================================================================
+// Name        : fp_shm_producer.cpp
+// Description : Test producer of the shared-memory sample ring
+//============================================================================
+
+/*
+Stands in for the acquisition process: creates the shared-memory ring (see
+fp_shm.h) and writes samples into it, e.g.:
+
+./fp_generate_patterns --shm /fp_ring > datalog.csv &
+./fp_shm_producer /fp_ring < testdata.csv
+
+Samples are timestamp;value lines on stdin (timestamps converted by
+--utc-offset as in fp_generate_patterns) or synthetic ones (see fp_synth.h).
+The ring is closed (end of stream) and removed at the end.
+
+options:
+--capacity N       ring capacity in samples (power of two), default 65536
+--synthetic N      writes N synthetic samples instead of reading stdin
+--rate HZ          samples per second, default 0: as fast as the consumer takes them
+--utc-offset SEC   offset of input timestamps local time to UTC in seconds, default 0
+ */
+
+#include <iostream>
+#include <string_view>
+#include <vector>
+#include <chrono>
+#include <thread>
+#include <charconv>
+#include <cstdlib>
+#include <cstring>
+#include <unistd.h>
+
+#include "fp_reader.h"
+#include "fp_shm.h"
+#include "fp_synth.h"
+#include "fp_timestamp.h"
+
+// Samples written to the ring at once
+#define PRODUCER_CHUNK 256
+
+// paces writing to rate samples per second (0: no pacing)
+class Pacer {
+public:
+	explicit Pacer(double rate) : rate(rate), start(std::chrono::steady_clock::now()) {}
+
+	// waits until sample count is due
+	void wait(uint64_t count) {
+		if (rate <= 0)
+			return;
+		std::this_thread::sleep_until(start + std::chrono::duration_cast<std::chrono::steady_clock::duration>(
+			std::chrono::duration<double>(count / rate)));
+	}
+
+private:
+	double rate;
+	std::chrono::steady_clock::time_point start;
+};
+
+int main(int argc, char* argv[]) {
+	const char* name = nullptr;
+	long capacity = 1 << 16;
+	long synthetic = -1;
+	double rate = 0;
+	long utc_offset_sec = 0;
+
+	for (int i = 1; i < argc; i++) {
+		if (!strcmp(argv[i], "--capacity") && i + 1 < argc)
+			capacity = atol(argv[++i]);
+		else if (!strcmp(argv[i], "--synthetic") && i + 1 < argc)
+			synthetic = atol(argv[++i]);
+		else if (!strcmp(argv[i], "--rate") && i + 1 < argc)
+			rate = atof(argv[++i]);
+		else if (!strcmp(argv[i], "--utc-offset") && i + 1 < argc)
+			utc_offset_sec = atol(argv[++i]);
+		else if (strncmp(argv[i], "--", 2) != 0 && !name)
+			name = argv[i];
+		else {
+			name = nullptr;
+			break;
+		}
+	}
+	if (!name) {
+		std::cerr << "Usage: fp_shm_producer NAME [--capacity N] [--synthetic N] [--rate HZ] [--utc-offset SEC]" << std::endl;
+		return 1;
+	}
+
+	ShmRingProducer ring;
+	if (capacity <= 0 || !ring.create(name, static_cast<uint32_t>(capacity))) {
+		std::cerr << (capacity <= 0 ? "Invalid capacity" : ring.error()) << std::endl;
+		return 1;
+	}
+
+	std::vector<ShmSample> chunk;
+	chunk.reserve(PRODUCER_CHUNK);
+	Pacer pacer(rate);
+	uint64_t written = 0;
+
+	auto add = [&](int64_t t_usec, float value) {
+		chunk.push_back({ t_usec, value, 0 });
+		if (chunk.size() == PRODUCER_CHUNK || rate > 0) {
+			pacer.wait(written);
+			ring.write(chunk.data(), chunk.size());
+			written += chunk.size();
+			chunk.clear();
+		}
+	};
+
+	if (synthetic >= 0) {
+		SynthSource source;
+		int64_t t;
+		float v;
+		for (long i = 0; i < synthetic; i++) {
+			source.next(t, v);
+			add(t, v);
+		}
+	} else {
+		InputReader reader(STDIN_FILENO);
+		TimestampDecoder tsdecoder(utc_offset_sec);
+		std::string_view line, ts, valuetext;
+		while (reader.next_line(line)) {
+			split_fields(line, ts, valuetext);
+			double value;
+			int64_t t;
+			if (std::from_chars(valuetext.data(), valuetext.data() + valuetext.size(), value).ec != std::errc()
+					|| !tsdecoder.decode(ts, t))
+				continue;
+			add(t, value);
+		}
+		if (reader.failed()) {
+			std::cerr << "Input read error: " << strerror(reader.error()) << std::endl;
+			return 1;
+		}
+	}
+
+	ring.write(chunk.data(), chunk.size());
+	ring.close();
+	return 0;
+}
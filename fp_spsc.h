@@ -0,0 +1,115 @@
+//============================================================================
+// Name        : fp_spsc.h
+// Description : Lock-free single-producer/single-consumer ring buffer
+//============================================================================
+
+/*
+Bounded ring of N items (N power of two) for exactly one producer thread and
+one consumer thread. try_push()/try_pop() never block. push()/pop() spin for
+a while and then sleep on a futex until the other side makes progress, so an
+idle stage does not burn CPU; the futex is only touched when the other side
+is actually sleeping.
+ */
+
+#ifndef FP_SPSC_H_
+#define FP_SPSC_H_
+
+#include <atomic>
+#include <cstdint>
+#include <cstddef>
+#include <climits>
+#include <unistd.h>
+#include <sys/syscall.h>
+#include <linux/futex.h>
+
+// How many times to poll before sleeping
+#define SPSC_SPIN_COUNT 2000
+
+// waits while *addr == expected (or until woken up)
+inline void futex_wait(std::atomic<uint32_t>* addr, uint32_t expected) {
+	syscall(SYS_futex, reinterpret_cast<uint32_t*>(addr), FUTEX_WAIT, expected, nullptr, nullptr, 0);
+}
+
+// wakes up all waiters on addr
+inline void futex_wake(std::atomic<uint32_t>* addr) {
+	syscall(SYS_futex, reinterpret_cast<uint32_t*>(addr), FUTEX_WAKE, INT_MAX, nullptr, nullptr, 0);
+}
+
+// hint to the CPU within spin loops
+inline void cpu_relax() {
+#if defined(__x86_64__) || defined(__i386__)
+	__builtin_ia32_pause();
+#endif
+}
+
+
+template <class T, size_t N>
+class SpscRing {
+	static_assert(N && (N & (N - 1)) == 0, "ring size must be power of two");
+
+public:
+	bool try_push(const T& item) {
+		uint32_t h = head.load(std::memory_order_relaxed);
+		if (h - tail.load(std::memory_order_acquire) == N)
+			return false;
+		items[h & (N - 1)] = item;
+		head.store(h + 1, std::memory_order_seq_cst);
+		if (consumer_waiting.load(std::memory_order_seq_cst))
+			futex_wake(&head);
+		return true;
+	}
+
+	bool try_pop(T& item) {
+		uint32_t t = tail.load(std::memory_order_relaxed);
+		if (head.load(std::memory_order_acquire) == t)
+			return false;
+		item = items[t & (N - 1)];
+		tail.store(t + 1, std::memory_order_seq_cst);
+		if (producer_waiting.load(std::memory_order_seq_cst))
+			futex_wake(&tail);
+		return true;
+	}
+
+	// pushes item, waits while the ring is full
+	void push(const T& item) {
+		for (int spin = 0; !try_push(item); spin++) {
+			if (spin < SPSC_SPIN_COUNT) {
+				cpu_relax();
+				continue;
+			}
+			uint32_t t = tail.load(std::memory_order_seq_cst);
+			producer_waiting.store(1, std::memory_order_seq_cst);
+			// check again after announcing the wait, the consumer may have popped meanwhile
+			if (head.load(std::memory_order_relaxed) - tail.load(std::memory_order_seq_cst) == N)
+				futex_wait(&tail, t);
+			producer_waiting.store(0, std::memory_order_relaxed);
+		}
+	}
+
+	// pops item, waits while the ring is empty
+	T pop() {
+		T item;
+		for (int spin = 0; !try_pop(item); spin++) {
+			if (spin < SPSC_SPIN_COUNT) {
+				cpu_relax();
+				continue;
+			}
+			uint32_t h = head.load(std::memory_order_seq_cst);
+			consumer_waiting.store(1, std::memory_order_seq_cst);
+			if (head.load(std::memory_order_seq_cst) == tail.load(std::memory_order_relaxed))
+				futex_wait(&head, h);
+			consumer_waiting.store(0, std::memory_order_relaxed);
+		}
+		return item;
+	}
+
+private:
+	// indices on separate cache lines
+	alignas(64) std::atomic<uint32_t> head{0};   // written by producer
+	std::atomic<uint32_t> consumer_waiting{0};
+	alignas(64) std::atomic<uint32_t> tail{0};   // written by consumer
+	std::atomic<uint32_t> producer_waiting{0};
+	alignas(64) T items[N];
+};
+
+#endif /* FP_SPSC_H_ */
@@ -0,0 +1,270 @@
+//============================================================================
+// Name        : fp_stats.h
+// Description : Hot-path counters and periodic throughput report
+//============================================================================
+
+/*
+Counters of processed lines and samples and time spent in the stages read
+(waiting for and reading input blocks), parse, detect and write. Each counter
+is updated by one thread only (relaxed atomic store, no locked instructions),
+timing is done per input block or batch, not per line.
+
+The report (to stderr) is printed every --stats-interval seconds, on SIGUSR1
+and at the end when the interval is set:
+
+stats: lines 1000000 (500000/s), sampled out 0, parse failures 0, samples 1000000 (500000/s),
+alarms 3, patterns 2, read 5.0% parse 40.0% detect 10.0% write 45.0%, lag 0.012 s
+
+Rates are since the previous report, stage shares are of the wall time of the
+same period (in pipeline mode each stage has its own thread, so they may sum
+to more than 100%; parse is the rest of the input thread's time). With more
+channels, samples are evaluated row by row and only read is timed. lag is the
+difference between the wall clock and the timestamp of the latest sample.
+
+Read-to-emit latency histograms (see fp_histogram.h) of output rows and of
+alarm rows are printed with the report when latency tracking is on, and at
+the end in any case.
+
+With -DFP_DISABLE_STATS, the STATS_ macros compile to nothing and SIGUSR1 keeps
+its default action.
+ */
+
+#ifndef FP_STATS_H_
+#define FP_STATS_H_
+
+#include <atomic>
+#include <chrono>
+#include <cerrno>
+#include <cstdint>
+#include <cstdio>
+#include <thread>
+#include <csignal>
+#include <pthread.h>
+#include <time.h>
+
+#include "fp_detector.h"
+#include "fp_histogram.h"
+
+// counter updated by one thread, read by the reporter
+struct StatCounter {
+	std::atomic<uint64_t> value{0};
+
+	void add(uint64_t n) { value.store(value.load(std::memory_order_relaxed) + n, std::memory_order_relaxed); }
+	void set(uint64_t v) { value.store(v, std::memory_order_relaxed); }
+	uint64_t get() const { return value.load(std::memory_order_relaxed); }
+};
+
+// how stage times are measured
+enum StageTiming {
+	STAGES_SEQUENTIAL,   // all stages on one thread
+	STAGES_PIPELINED,    // detect and write on their own threads
+	STAGES_READ_ONLY     // detect and write are not timed
+};
+
+struct ProgramStats {
+	StatCounter lines;            // input lines (rows, records) read
+	StatCounter sampled_out;      // lines skipped by sampling
+	StatCounter parse_failures;   // lines skipped as invalid
+	StatCounter samples;          // evaluated samples
+	StatCounter alarms;
+	StatCounter patterns;         // ended patterns
+	StatCounter last_sample_usec; // timestamp of the latest evaluated sample
+
+	// nanoseconds spent in stages
+	StatCounter read_ns, detect_ns, write_ns;
+
+	// start of read() in progress, 0 if none
+	StatCounter read_started_ns;
+
+	StageTiming stage_timing = STAGES_SEQUENTIAL;
+
+	// read-to-emit latency of output rows (each latency_every-th) and alarm rows, 0: not tracked
+	long latency_every = 0;
+	LatencyHistogram latency_rows, latency_alarms;
+
+	// patternid of the last evaluated sample (detect stage)
+	int last_patternid = 0;
+};
+
+inline ProgramStats program_stats;
+
+inline int64_t stats_now_ns() {
+	return std::chrono::duration_cast<std::chrono::nanoseconds>(
+		std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+// counts alarms and ended patterns of evaluated samples
+inline void stats_results(const int64_t* t_usec, const AlarmNoiseRejectResult* r, size_t n) {
+	if (!n)
+		return;
+	ProgramStats& s = program_stats;
+	uint64_t alarms = 0, patterns = 0;
+	for (size_t i = 0; i < n; i++) {
+		alarms += r[i].isalarm;
+		patterns += s.last_patternid && r[i].patternid != s.last_patternid;
+		s.last_patternid = r[i].patternid;
+	}
+	s.samples.add(n);
+	s.alarms.add(alarms);
+	s.patterns.add(patterns);
+	s.last_sample_usec.set(t_usec[n - 1]);
+}
+
+#ifndef FP_DISABLE_STATS
+#define STATS_ADD(counter, n) program_stats.counter.add(n)
+#define STATS_SET(counter, v) program_stats.counter.set(v)
+#define STATS_RESULTS(t_usec, results, n) stats_results(t_usec, results, n)
+#define STATS_TIME_START(var) int64_t var = stats_now_ns()
+#define STATS_TIME_END(var, counter) program_stats.counter.add(stats_now_ns() - var)
+#define STATS_READ_START() program_stats.read_started_ns.set(stats_now_ns())
+#define STATS_READ_END() do { \
+		program_stats.read_ns.add(stats_now_ns() - program_stats.read_started_ns.get()); \
+		program_stats.read_started_ns.set(0); \
+	} while (0)
+#else
+#define STATS_ADD(counter, n) ((void) 0)
+#define STATS_SET(counter, v) ((void) 0)
+#define STATS_RESULTS(t_usec, results, n) ((void) 0)
+#define STATS_TIME_START(var) ((void) 0)
+#define STATS_TIME_END(var, counter) ((void) 0)
+#define STATS_READ_START() ((void) 0)
+#define STATS_READ_END() ((void) 0)
+#endif
+
+
+// prints report periodically and on SIGUSR1
+class StatsReporter {
+public:
+	// blocks SIGUSR1, to be called before any thread is started
+	static void block_signal() {
+#ifndef FP_DISABLE_STATS
+		sigset_t set;
+		sigemptyset(&set);
+		sigaddset(&set, SIGUSR1);
+		pthread_sigmask(SIG_BLOCK, &set, nullptr);
+#endif
+	}
+
+	// starts reporting thread, interval_sec 0: on SIGUSR1 only
+	void start(double interval_sec) {
+#ifndef FP_DISABLE_STATS
+		interval = interval_sec;
+		start_ns = last_ns = stats_now_ns();
+		thread = std::thread([this] { run(); });
+#endif
+	}
+
+	// stops reporting thread, prints final report if periodic and latencies if tracked
+	void stop() {
+		if (thread.joinable()) {
+			stopping.store(true);
+			pthread_kill(thread.native_handle(), SIGUSR1);
+			thread.join();
+			// the final report includes latencies
+			if (interval > 0) {
+				report();
+				latency_printed = true;
+			}
+		}
+		if (program_stats.latency_every && !latency_printed) {
+			print_latency();
+			latency_printed = true;
+		}
+	}
+
+	~StatsReporter() { stop(); }
+
+private:
+	void run() {
+		sigset_t set;
+		sigemptyset(&set);
+		sigaddset(&set, SIGUSR1);
+		for (;;) {
+			int sig;
+			if (interval > 0) {
+				struct timespec timeout;
+				timeout.tv_sec = static_cast<time_t>(interval);
+				timeout.tv_nsec = static_cast<long>((interval - timeout.tv_sec) * 1e9);
+				sig = sigtimedwait(&set, nullptr, &timeout);
+			} else
+				sig = sigwaitinfo(&set, nullptr);
+			if (stopping.load())
+				return;
+			if (sig == SIGUSR1 || (sig < 0 && errno == EAGAIN))
+				report();
+		}
+	}
+
+	void report() {
+		const ProgramStats& s = program_stats;
+		int64_t now = stats_now_ns();
+		double sec = (now - last_ns) * 1e-9;
+		if (sec <= 0)
+			sec = 1e-9;
+
+		uint64_t lines = s.lines.get(), samples = s.samples.get();
+
+		// read() in progress (e.g. waiting for input) counts up to now
+		int64_t read_started = s.read_started_ns.get();
+		int64_t read_total = s.read_ns.get() + (read_started ? now - read_started : 0);
+		double read = (read_total - last_read) * 1e-9;
+		if (read < 0)
+			read = 0;
+		double detect = (s.detect_ns.get() - last_detect) * 1e-9;
+		double write = (s.write_ns.get() - last_write) * 1e-9;
+		double parse = sec - read - (s.stage_timing == STAGES_SEQUENTIAL ? detect + write : 0);
+		if (parse < 0)
+			parse = 0;
+
+		char stages[128];
+		if (s.stage_timing == STAGES_READ_ONLY)
+			snprintf(stages, sizeof(stages), "read %.1f%%", 100 * read / sec);
+		else
+			snprintf(stages, sizeof(stages), "read %.1f%% parse %.1f%% detect %.1f%% write %.1f%%",
+				100 * read / sec, 100 * parse / sec, 100 * detect / sec, 100 * write / sec);
+
+		double lag = 0;
+		if (s.last_sample_usec.get()) {
+			int64_t wall_usec = std::chrono::duration_cast<std::chrono::microseconds>(
+				std::chrono::system_clock::now().time_since_epoch()).count();
+			lag = (wall_usec - static_cast<int64_t>(s.last_sample_usec.get())) * 1e-6;
+		}
+
+		fprintf(stderr, "stats: lines %llu (%.0f/s), sampled out %llu, parse failures %llu, samples %llu (%.0f/s), "
+			"alarms %llu, patterns %llu, %s, lag %.3f s\n",
+			(unsigned long long) lines, (lines - last_lines) / sec,
+			(unsigned long long) s.sampled_out.get(), (unsigned long long) s.parse_failures.get(),
+			(unsigned long long) samples, (samples - last_samples) / sec,
+			(unsigned long long) s.alarms.get(), (unsigned long long) s.patterns.get(),
+			stages, lag);
+
+		print_latency();
+
+		last_ns = now;
+		last_lines = lines;
+		last_samples = samples;
+		last_read = read_total;
+		last_detect = s.detect_ns.get();
+		last_write = s.write_ns.get();
+	}
+
+	void print_latency() {
+		if (!program_stats.latency_every)
+			return;
+		program_stats.latency_rows.print(stderr, "latency rows");
+		program_stats.latency_alarms.print(stderr, "latency alarms");
+	}
+
+	double interval = 0;
+	bool latency_printed = false;
+	std::thread thread;
+	std::atomic<bool> stopping{false};
+
+	// values at the previous report
+	int64_t start_ns = 0, last_ns = 0;
+	uint64_t last_lines = 0, last_samples = 0;
+	int64_t last_read = 0;
+	uint64_t last_detect = 0, last_write = 0;
+};
+
+#endif /* FP_STATS_H_ */
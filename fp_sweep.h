@@ -0,0 +1,168 @@
+//============================================================================
+// Name        : fp_sweep.h
+// Description : Parameter sets for single-pass parameter sweeps
+//============================================================================
+
+/*
+Sweep file holds parameter sets, one line per set (or per grid of sets) with
+the seven parameters in the order of program arguments:
+
+SAMPLE_EACH INITIAL_AVG_DIFF NUMBER_OF_POINTS_TO_ALARM WAIT_STATE_USEC MULTIPLICATOR_TO_DETECT N_AMEND_AVGDIFF PATTERN_STATE_USEC
+
+Fields are separated by spaces, tabs or ;. Each field is a comma separated
+list of integers or ranges start:stop[:step] (stop included). A line with
+lists or ranges expands to all their combinations. Empty lines and lines
+starting with # are ignored. E.g.
+
+# 3 x 2 = 6 sets
+1 200 3:5 1000000 10,20 500 250000
+
+All sets are evaluated in lockstep over the same parsed input by
+MultiChannelDetector (one lane per set), see run_sweep().
+ */
+
+#ifndef FP_SWEEP_H_
+#define FP_SWEEP_H_
+
+#include <iostream>
+#include <fstream>
+#include <string>
+#include <vector>
+#include <cstdlib>
+#include <cstdint>
+#include <climits>
+
+#include "fp_detector.h"
+
+// Maximum number of parameter sets in one sweep
+#define MAX_SWEEP_SETS 1000000
+
+// summary of one parameter set after the sweep
+struct SweepSummary {
+	long long alarms = 0;
+	std::string first_alarm;   // timestamp of the first alarm
+	std::string last_alarm;    // timestamp of the last alarm
+};
+
+
+// parses one field (list of integers and ranges) into values, false on error
+// (including values out of the int range of detector parameters)
+inline bool parse_sweep_field(const std::string& field, std::vector<long>& values) {
+	size_t start = 0;
+	while (start <= field.size()) {
+		size_t comma = field.find(',', start);
+		std::string item = field.substr(start, comma == std::string::npos ? std::string::npos : comma - start);
+
+		long v[3] = { 0, 0, 1 };
+		int n = 0;
+		const char* p = item.c_str();
+		for (;;) {
+			char* endp;
+			v[n] = strtol(p, &endp, 10);
+			if (endp == p || v[n] < INT_MIN || v[n] > INT_MAX)
+				return false;
+			n++;
+			if (*endp == '\0')
+				break;
+			if (*endp != ':' || n == 3)
+				return false;
+			p = endp + 1;
+		}
+		if (n == 1)
+			values.push_back(v[0]);
+		else {
+			if (v[2] < 1 || v[1] < v[0])
+				return false;
+			for (long x = v[0]; x <= v[1]; x += v[2]) {
+				values.push_back(x);
+				if (values.size() > MAX_SWEEP_SETS)
+					return false;
+			}
+		}
+
+		if (comma == std::string::npos)
+			break;
+		start = comma + 1;
+	}
+	return true;
+}
+
+// reads sweep file into parameter sets, false (with a message) on error
+inline bool read_sweep_file(const char* filename, std::vector<AlarmNoiseRejectParams>& sets) {
+	std::ifstream in(filename);
+	if (!in) {
+		std::cerr << "Cannot open sweep file " << filename << std::endl;
+		return false;
+	}
+
+	std::string line;
+	int lineno = 0;
+	while (std::getline(in, line)) {
+		lineno++;
+		size_t first = line.find_first_not_of(" \t\r");
+		if (first == std::string::npos || line[first] == '#')
+			continue;
+
+		// split to fields and expand them
+		std::vector<long> fields[7];
+		size_t nfields = 0;
+		size_t pos = first;
+		while (pos < line.size()) {
+			size_t end = line.find_first_of(" \t;\r", pos);
+			if (end == std::string::npos)
+				end = line.size();
+			if (end > pos) {
+				if (nfields == 7 || !parse_sweep_field(line.substr(pos, end - pos), fields[nfields])) {
+					std::cerr << "Invalid sweep file line " << lineno << ": " << line << std::endl;
+					return false;
+				}
+				nfields++;
+			}
+			pos = end + 1;
+		}
+		if (nfields != 7) {
+			std::cerr << "Sweep file line " << lineno << " must have 7 fields: " << line << std::endl;
+			return false;
+		}
+
+		// all combinations, the last field changes fastest
+		size_t combinations = 1;
+		for (const std::vector<long>& f : fields) {
+			combinations *= f.size();
+			if (combinations + sets.size() > MAX_SWEEP_SETS) {
+				std::cerr << "Too many parameter sets in sweep (max " << MAX_SWEEP_SETS << ")" << std::endl;
+				return false;
+			}
+		}
+		for (size_t c = 0; c < combinations; c++) {
+			long v[7];
+			size_t rest = c;
+			for (int i = 6; i >= 0; i--) {
+				v[i] = fields[i][rest % fields[i].size()];
+				rest /= fields[i].size();
+			}
+			AlarmNoiseRejectParams p;
+			p.sample_each = v[0];
+			p.initial_avg_diff = v[1];
+			p.number_of_points_to_alarm = v[2];
+			p.wait_state_usec = v[3];
+			p.multiplicator_to_detect = v[4];
+			p.n_amend_avgdiff = v[5];
+			p.pattern_state_usec = v[6];
+			if (!p.valid()) {
+				std::cerr << "Invalid parameter set from sweep file line " << lineno << ":" << std::endl;
+				p.print(std::cerr);
+				return false;
+			}
+			sets.push_back(p);
+		}
+	}
+
+	if (sets.empty()) {
+		std::cerr << "No parameter sets in sweep file " << filename << std::endl;
+		return false;
+	}
+	return true;
+}
+
+#endif /* FP_SWEEP_H_ */
@@ -0,0 +1,168 @@
+//============================================================================
+// Name        : fp_synth.h
+// Description : Synthetic sensor samples for benchmarks and tests
+//============================================================================
+
+/*
+Generates a deterministic stream of samples resembling the measured data:
+values around a base level with uniform noise, sampled every period_usec,
+with rare bursts (several samples of large differences) that raise alarms.
+The same seed gives the same stream.
+
+SynthSource source(synth_params);
+int64_t t;
+float v;
+while (...) {
+	source.next(t, v);
+	...
+}
+
+SynthRandom and burst_offset() are the building blocks for other generators
+(see fp_generate_data.cpp), synth_line() formats a sample as the input line "dd-mm-yyyy hh:mm:ss.ffffff;value"
+(or a row of values of more channels).
+ */
+
+#ifndef FP_SYNTH_H_
+#define FP_SYNTH_H_
+
+#include <string>
+#include <cstdint>
+#include <cmath>
+#include <charconv>
+
+#include "fp_timestamp.h"
+
+struct SynthParams {
+	int64_t start_usec = 1457623620000000LL;  // 10-03-2016 15:27:00
+	int64_t period_usec = 64;                 // time between samples
+	double base = 69000;                      // mean value
+	double noise = 150;                       // noise amplitude (+-)
+	double burst_probability = 1e-5;          // probability of burst start per sample
+	int burst_length = 32;                    // samples of a burst
+	double burst_amplitude = 50000;           // amplitude of burst differences (+-)
+	uint64_t seed = 1;
+};
+
+// deterministic random numbers, xorshift64*
+class SynthRandom {
+public:
+	explicit SynthRandom(uint64_t seed = 1) : state(seed ? seed : 1) {}
+
+	uint64_t next() {
+		state ^= state >> 12;
+		state ^= state << 25;
+		state ^= state >> 27;
+		return state * 0x2545F4914F6CDD1DULL;
+	}
+
+	// uniform in [0, 1)
+	double uniform() {
+		return (next() >> 11) * (1.0 / 9007199254740992.0);
+	}
+
+	// number of failures before the first success with probability p (p > 0)
+	uint64_t geometric(double p) {
+		if (p >= 1)
+			return 0;
+		double n = std::floor(std::log1p(-uniform()) / std::log1p(-p));
+		return n < 1e18 ? static_cast<uint64_t>(n) : static_cast<uint64_t>(1e18);
+	}
+
+private:
+	uint64_t state;
+};
+
+// shapes of injected bursts
+enum BurstShape {
+	BURST_NOISE,     // random differences of up to +-amplitude
+	BURST_SINE,      // oscillation with period of 8 samples
+	BURST_RINGING,   // alternating sign, exponentially decaying
+	BURST_STEP,      // constant offset (one large difference only, not detectable)
+	BURST_SHAPES
+};
+
+inline const char* burst_shape_name(int shape) {
+	static const char* names[BURST_SHAPES] = { "noise", "sine", "ringing", "step" };
+	return names[shape];
+}
+
+// shape of name, false if unknown
+inline bool parse_burst_shape(const std::string& name, BurstShape& shape) {
+	for (int i = 0; i < BURST_SHAPES; i++) {
+		if (name == burst_shape_name(i)) {
+			shape = static_cast<BurstShape>(i);
+			return true;
+		}
+	}
+	return false;
+}
+
+// value added to sample k of a burst of length n, u uniform in [0, 1)
+inline double burst_offset(BurstShape shape, int k, int n, double amplitude, double u) {
+	switch (shape) {
+	case BURST_NOISE:
+		return amplitude * (2 * u - 1);
+	case BURST_SINE:
+		return amplitude * std::sin(k * (M_PI / 4));
+	case BURST_RINGING:
+		return (k & 1 ? -amplitude : amplitude) * std::exp(-4.0 * k / n);
+	default:
+		return amplitude;
+	}
+}
+
+
+class SynthSource {
+public:
+	explicit SynthSource(const SynthParams& params = SynthParams()) : p(params), rng(params.seed) {
+		t = p.start_usec;
+	}
+
+	// next sample, values are whole numbers as from a counter
+	void next(int64_t& t_usec, float& value) {
+		double v = p.base + p.noise * (2 * uniform() - 1);
+		if (burst_left) {
+			burst_left--;
+			v += p.burst_amplitude * (2 * uniform() - 1);
+		} else if (uniform() < p.burst_probability) {
+			burst_left = p.burst_length;
+			bursts++;
+		}
+		t_usec = t;
+		value = std::round(v);
+		t += p.period_usec;
+	}
+
+	// number of bursts started so far
+	long long burst_count() const { return bursts; }
+
+private:
+	double uniform() { return rng.uniform(); }
+
+	SynthParams p;
+	SynthRandom rng;
+	int64_t t;
+	int burst_left = 0;
+	long long bursts = 0;
+};
+
+// appends input line "dd-mm-yyyy hh:mm:ss.ffffff;value1[;value2...]\n" of n values to line
+inline void synth_line(int64_t t_usec, const float* values, size_t n, long utc_offset_sec, std::string& line) {
+	char buf[TIMESTAMP_TEXT_LEN];
+	format_timestamp(t_usec, utc_offset_sec, buf);
+	line.append(buf, TIMESTAMP_TEXT_LEN);
+	for (size_t i = 0; i < n; i++) {
+		char num[24];
+		num[0] = ';';
+		char* end = std::to_chars(num + 1, num + sizeof(num), static_cast<long long>(values[i])).ptr;
+		line.append(num, end - num);
+	}
+	line.push_back('\n');
+}
+
+// appends input line "dd-mm-yyyy hh:mm:ss.ffffff;value\n" to line
+inline void synth_line(int64_t t_usec, float value, long utc_offset_sec, std::string& line) {
+	synth_line(t_usec, &value, 1, utc_offset_sec, line);
+}
+
+#endif /* FP_SYNTH_H_ */
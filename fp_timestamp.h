@@ -0,0 +1,193 @@
+//============================================================================
+// Name        : fp_timestamp.h
+// Description : Fast conversion of input timestamps to microseconds
+//============================================================================
+
+/*
+Decodes timestamps in the input format
+
+dd-mm-yyyy hh:mm:ss.ffffff   e.g. 10-03-2016 15:19:20.729915
+
+into a single int64 value of microseconds since the epoch.
+
+Subsequent samples share the same date and usually the same second, so the
+decoder remembers the text up to the decimal point together with its epoch
+second; in that case only the fraction is parsed. When the prefix changes,
+the fields are parsed and the epoch of the day is reused while the date stays
+the same. Calendar math is done in UTC (no mktime, no TZ database), input
+times in a fixed local zone are handled by utc_offset_sec.
+
+Field widths may vary like with sscanf("%d-%d-%d %d:%d:%d.%d"), the fraction
+is taken as decimal fraction of the second (.5 == 500000 usec), digits beyond
+microseconds are ignored.
+
+format_timestamp() does the opposite, for input without timestamp texts.
+ */
+
+#ifndef FP_TIMESTAMP_H_
+#define FP_TIMESTAMP_H_
+
+#include <string_view>
+#include <cstdint>
+#include <cstring>
+
+// days since 1970-01-01 of proleptic gregorian date (m 1..12)
+inline int64_t days_from_civil(int64_t y, unsigned m, unsigned d) {
+	y -= m <= 2;
+	const int64_t era = (y >= 0 ? y : y - 399) / 400;
+	const unsigned yoe = static_cast<unsigned>(y - era * 400);
+	const unsigned doy = (153 * (m > 2 ? m - 3 : m + 9) + 2) / 5 + d - 1;
+	const unsigned doe = yoe * 365 + yoe / 4 - yoe / 100 + doy;
+	return era * 146097 + static_cast<int64_t>(doe) - 719468;
+}
+
+// proleptic gregorian date of days since 1970-01-01
+inline void civil_from_days(int64_t z, int& y, unsigned& m, unsigned& d) {
+	z += 719468;
+	const int64_t era = (z >= 0 ? z : z - 146096) / 146097;
+	const unsigned doe = static_cast<unsigned>(z - era * 146097);
+	const unsigned yoe = (doe - doe / 1460 + doe / 36524 - doe / 146096) / 365;
+	const unsigned doy = doe - (365 * yoe + yoe / 4 - yoe / 100);
+	const unsigned mp = (5 * doy + 2) / 153;
+	d = doy - (153 * mp + 2) / 5 + 1;
+	m = mp < 10 ? mp + 3 : mp - 9;
+	y = static_cast<int>(yoe + era * 400 + (m <= 2));
+}
+
+// Length of formatted timestamp "dd-mm-yyyy hh:mm:ss.ffffff"
+#define TIMESTAMP_TEXT_LEN 26
+
+// formats microseconds since epoch as dd-mm-yyyy hh:mm:ss.ffffff into buf
+// (TIMESTAMP_TEXT_LEN characters, not terminated), utc_offset_sec as for TimestampDecoder
+inline void format_timestamp(int64_t usec, long utc_offset_sec, char* buf) {
+	int64_t sec = usec / 1000000;
+	int64_t frac = usec % 1000000;
+	if (frac < 0) {
+		frac += 1000000;
+		sec--;
+	}
+	sec += utc_offset_sec;
+	int64_t days = sec / 86400;
+	int64_t sod = sec % 86400;
+	if (sod < 0) {
+		sod += 86400;
+		days--;
+	}
+	int y;
+	unsigned m, d;
+	civil_from_days(days, y, m, d);
+
+	auto put2 = [](char* p, unsigned v) { p[0] = '0' + v / 10; p[1] = '0' + v % 10; };
+	put2(buf, d); buf[2] = '-';
+	put2(buf + 3, m); buf[5] = '-';
+	put2(buf + 6, (y / 100) % 100); put2(buf + 8, y % 100); buf[10] = ' ';
+	put2(buf + 11, sod / 3600); buf[13] = ':';
+	put2(buf + 14, sod / 60 % 60); buf[16] = ':';
+	put2(buf + 17, sod % 60); buf[19] = '.';
+	for (int i = 25; i > 19; i--, frac /= 10)
+		buf[i] = '0' + frac % 10;
+}
+
+
+class TimestampDecoder {
+public:
+	// utc_offset_sec: offset of input local time to UTC, e.g. 3600 for CET
+	explicit TimestampDecoder(long utc_offset_sec = 0) : utc_offset_sec(utc_offset_sec) {}
+
+	// decodes text into microseconds since epoch, false if text is not a timestamp
+	bool decode(std::string_view text, int64_t& usec) {
+		const char* p = text.data();
+		const char* end = p + text.size();
+
+		// same second as previous sample: parse the fraction only
+		if (prefix_len && text.size() >= prefix_len && memcmp(p, prefix, prefix_len) == 0) {
+			usec = prefix_sec * 1000000 + parse_fraction(p + prefix_len, end);
+			return true;
+		}
+
+		int d, m, y, h, mi, s;
+		if (!parse_int(p, end, d) || !expect(p, end, '-') ||
+			!parse_int(p, end, m) || !expect(p, end, '-') ||
+			!parse_int(p, end, y) ||
+			!parse_int(p, end, h) || !expect(p, end, ':') ||
+			!parse_int(p, end, mi) || !expect(p, end, ':') ||
+			!parse_int(p, end, s))
+			return false;
+		if (m < 1 || m > 12)
+			return false;
+
+		// epoch of the day is recomputed only when the date changes
+		if (d != cached_d || m != cached_m || y != cached_y) {
+			cached_d = d; cached_m = m; cached_y = y;
+			day_sec = days_from_civil(y, m, d) * 86400 - utc_offset_sec;
+		}
+		int64_t sec = day_sec + h * 3600 + mi * 60 + s;
+
+		long frac = 0;
+		if (p < end && *p == '.') {
+			++p;
+			// remember text up to and including '.' for subsequent samples
+			size_t len = p - text.data();
+			if (len <= sizeof(prefix)) {
+				memcpy(prefix, text.data(), len);
+				prefix_len = len;
+				prefix_sec = sec;
+			}
+			frac = parse_fraction(p, end);
+		} else {
+			prefix_len = 0;
+		}
+
+		usec = sec * 1000000 + frac;
+		return true;
+	}
+
+private:
+	// parses fraction of second into microseconds
+	static long parse_fraction(const char* p, const char* end) {
+		long frac = 0;
+		int digits = 0;
+		for (; p < end && digits < 6 && (unsigned) (*p - '0') < 10; ++p, ++digits)
+			frac = frac * 10 + (*p - '0');
+		for (; digits < 6; ++digits)
+			frac *= 10;
+		return frac;
+	}
+
+	// parses integer, skipping leading whitespace like %d
+	static bool parse_int(const char*& p, const char* end, int& value) {
+		while (p < end && (*p == ' ' || *p == '\t'))
+			++p;
+		bool neg = false;
+		if (p < end && (*p == '-' || *p == '+'))
+			neg = (*p++ == '-');
+		if (p == end || (unsigned) (*p - '0') >= 10)
+			return false;
+		int v = 0;
+		for (; p < end && (unsigned) (*p - '0') < 10; ++p)
+			v = v * 10 + (*p - '0');
+		value = neg ? -v : v;
+		return true;
+	}
+
+	static bool expect(const char*& p, const char* end, char ch) {
+		if (p < end && *p == ch) {
+			++p;
+			return true;
+		}
+		return false;
+	}
+
+	long utc_offset_sec;
+
+	// cached text up to the decimal point and its epoch second
+	char prefix[32];
+	size_t prefix_len = 0;
+	int64_t prefix_sec = 0;
+
+	// cached date and epoch of its midnight
+	int cached_d = 0, cached_m = 0, cached_y = 0;
+	int64_t day_sec = 0;
+};
+
+#endif /* FP_TIMESTAMP_H_ */
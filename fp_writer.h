@@ -0,0 +1,167 @@
+//============================================================================
+// Name        : fp_writer.h
+// Description : Buffered output sink with std::to_chars formatting
+//============================================================================
+
+/*
+Output rows are formatted into one large reusable buffer (integers and floats
+by std::to_chars) and written by a single write() call per block.
+
+Floats are formatted like std::ostream with default precision (%.6g), so the
+output is the same as with std::cout << value.
+
+Flush policy says when the buffer is written besides being full:
+
+FLUSH_LINE  - after each row (like std::endl, slowest)
+FLUSH_BLOCK - before the input reader waits for next input block (default)
+FLUSH_ALARM - after each row with alarm
+FLUSH_EXIT  - only when the buffer is full and on exit
+
+A write hook may be set to be called after the buffer is written (e.g. for
+latency tracking, see fp_histogram.h).
+ */
+
+#ifndef FP_WRITER_H_
+#define FP_WRITER_H_
+
+#include <string_view>
+#include <vector>
+#include <functional>
+#include <charconv>
+#include <cstring>
+#include <cerrno>
+#include <cstdint>
+#include <unistd.h>
+
+// Size of the output buffer
+#define OUTPUT_BUFFER_SIZE (1 << 20)
+
+enum FlushPolicy {
+	FLUSH_LINE,
+	FLUSH_BLOCK,
+	FLUSH_ALARM,
+	FLUSH_EXIT
+};
+
+// parses flush policy name (line, block, alarm, exit), false if unknown
+inline bool parse_flush_policy(std::string_view name, FlushPolicy& policy) {
+	if (name == "line") policy = FLUSH_LINE;
+	else if (name == "block") policy = FLUSH_BLOCK;
+	else if (name == "alarm") policy = FLUSH_ALARM;
+	else if (name == "exit") policy = FLUSH_EXIT;
+	else return false;
+	return true;
+}
+
+
+class OutputWriter {
+public:
+	explicit OutputWriter(int fd, FlushPolicy policy = FLUSH_BLOCK, size_t size = OUTPUT_BUFFER_SIZE)
+		: fd(fd), policy(policy), buffer(size) {
+		pos = buffer.data();
+		end = buffer.data() + buffer.size();
+	}
+
+	~OutputWriter() {
+		flush();
+	}
+
+	OutputWriter(const OutputWriter&) = delete;
+	OutputWriter& operator=(const OutputWriter&) = delete;
+
+	void put(char ch) {
+		reserve(1);
+		*pos++ = ch;
+	}
+
+	void put(std::string_view str) {
+		if (str.size() > buffer.size()) {
+			// does not fit at all, write directly
+			flush();
+			write_all(str.data(), str.size());
+			if (write_hook)
+				write_hook();
+			return;
+		}
+		reserve(str.size());
+		memcpy(pos, str.data(), str.size());
+		pos += str.size();
+	}
+
+	void put_int(long long value) {
+		reserve(24);
+		pos = std::to_chars(pos, end, value).ptr;
+	}
+
+	// formats like std::ostream << value with default precision
+	void put_float(float value) {
+		reserve(32);
+		pos = std::to_chars(pos, end, value, std::chars_format::general, 6).ptr;
+	}
+
+	// terminates row, alarm says if the row reports an alarm
+	void end_row(bool alarm = false) {
+		put('\n');
+		if (policy == FLUSH_LINE || (alarm && policy == FLUSH_ALARM))
+			flush();
+	}
+
+	// to be called before the input waits for more data
+	void input_block_end() {
+		if (policy == FLUSH_BLOCK)
+			flush();
+	}
+
+	// writes buffered data
+	void flush() {
+		if (pos != buffer.data()) {
+			write_all(buffer.data(), pos - buffer.data());
+			pos = buffer.data();
+			if (write_hook)
+				write_hook();
+		}
+	}
+
+	// sets function called after each write of buffered data
+	void set_write_hook(std::function<void()> hook) { write_hook = std::move(hook); }
+
+	// number of bytes written so far
+	uint64_t written() const { return written_total; }
+
+	// false if there is no write error
+	bool failed() const { return write_error != 0; }
+	int error() const { return write_error; }
+
+private:
+	// makes space for n bytes
+	void reserve(size_t n) {
+		if (static_cast<size_t>(end - pos) < n)
+			flush();
+	}
+
+	void write_all(const char* data, size_t len) {
+		while (len && !write_error) {
+			ssize_t n = write(fd, data, len);
+			if (n < 0) {
+				if (errno != EINTR)
+					write_error = errno;
+				continue;
+			}
+			data += n;
+			len -= n;
+			written_total += n;
+		}
+	}
+
+	int fd;
+	FlushPolicy policy;
+	std::vector<char> buffer;
+	char* pos;
+	char* end;
+	int write_error = 0;
+	uint64_t written_total = 0;
+
+	std::function<void()> write_hook;
+};
+
+#endif /* FP_WRITER_H_ */